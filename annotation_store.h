@@ -0,0 +1,147 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_ANNOTATION_STORE_H__
+#define LFL_EDITOR_ANNOTATION_STORE_H__
+namespace LFL {
+
+// Style runs for many lines in two flat arrays instead of a DrawableAnnotation per line.
+// A slot names one line's runs.  Rewriting a slot reuses its runs in place when the new
+// ones fit and appends them otherwise; the arrays are compacted once half is garbage.
+struct AnnotationStore {
+  vector<int> slot_begin, slot_size, span_offset, span_attr;
+  size_t garbage=0;
+
+  int Slots() const { return slot_begin.size(); }
+  size_t Bytes() const { return (slot_begin.capacity() + slot_size.capacity() + span_offset.capacity() + span_attr.capacity()) * sizeof(int); }
+  void Clear() { slot_begin.clear(); slot_size.clear(); span_offset.clear(); span_attr.clear(); garbage = 0; }
+
+  // Frees every slot's runs but keeps the slots, since lines still name them.
+  void ClearRuns() {
+    fill(slot_begin.begin(), slot_begin.end(), 0);
+    fill(slot_size.begin(), slot_size.end(), 0);
+    vector<int>().swap(span_offset);
+    vector<int>().swap(span_attr);
+    garbage = 0;
+  }
+
+  int AddSlot() {
+    slot_begin.push_back(span_offset.size());
+    slot_size.push_back(0);
+    return slot_begin.size() - 1;
+  }
+
+  // Drops runs repeating the previous run's attr.
+  static void Pack(DrawableAnnotation *a) {
+    size_t out = 0;
+    for (size_t i = 0, n = a->size(); i < n; i++)
+      if (!out || (*a)[i].second != (*a)[out-1].second) (*a)[out++] = (*a)[i];
+    a->resize(out);
+  }
+
+  void Set(int slot, const DrawableAnnotation &a) {
+    while (slot >= Slots()) AddSlot();
+    int n = a.size(), &begin = slot_begin[slot], &size = slot_size[slot];
+    if (n > size) {
+      garbage += size;
+      begin = span_offset.size();
+      span_offset.resize(begin + n);
+      span_attr.resize(begin + n);
+    } else garbage += size - n;
+    size = n;
+    for (int i = 0; i < n; i++) { span_offset[begin + i] = a[i].first; span_attr[begin + i] = a[i].second; }
+    if (garbage > 4096 && garbage * 2 > span_offset.size()) Compact();
+  }
+
+  bool Equal(int slot, const AnnotationStore &x, int x_slot) const {
+    int n = slot_size[slot], b = slot_begin[slot], xb = x.slot_begin[x_slot];
+    return n == x.slot_size[x_slot] && equal(span_offset.begin() + b, span_offset.begin() + b + n, x.span_offset.begin() + xb) &&
+      equal(span_attr.begin() + b, span_attr.begin() + b + n, x.span_attr.begin() + xb);
+  }
+
+  void Get(int slot, DrawableAnnotation *out) const {
+    out->clear();
+    if (slot < 0 || slot >= Slots()) return;
+    for (int i = slot_begin[slot], e = i + slot_size[slot]; i < e; i++) out->emplace_back(span_offset[i], span_attr[i]);
+  }
+
+  void Assign(const vector<DrawableAnnotation> &lines) {
+    Clear();
+    DrawableAnnotation packed;
+    for (auto &a : lines) { packed = a; Pack(&packed); Set(AddSlot(), packed); }
+  }
+
+  void Compact() {
+    vector<int> offset, attr;
+    offset.reserve(span_offset.size() - garbage);
+    attr.reserve(span_offset.size() - garbage);
+    for (int s = 0, n = Slots(); s < n; s++) {
+      int begin = slot_begin[s];
+      slot_begin[s] = offset.size();
+      offset.insert(offset.end(), span_offset.begin() + begin, span_offset.begin() + begin + slot_size[s]);
+      attr  .insert(attr  .end(), span_attr  .begin() + begin, span_attr  .begin() + begin + slot_size[s]);
+    }
+    swap(span_offset, offset);
+    swap(span_attr, attr);
+    garbage = 0;
+  }
+};
+
+// Every edit's line and the lines it inserted and erased, in edit order, so a line number
+// from the buffer as it was at Position() can be carried to the current buffer and back
+// in time proportional to the edits made since.  Positions stay valid across Trim.
+struct LineDeltas {
+  struct Edit { int line, inserted, erased; };
+  vector<Edit> edit;
+  int base=0;
+
+  int Position() const { return base + edit.size(); }
+  void Add(int line, int inserted, int erased) { edit.push_back(Edit{ line, inserted, erased }); }
+
+  // Forgets the edits before position, once no line number from before it is in use.
+  void Trim(int position) {
+    int n = max(0, min(int(edit.size()), position - base));
+    edit.erase(edit.begin(), edit.begin() + n);
+    base += n;
+  }
+
+  // Returns -1 if the line was erased since.
+  int ToCurrent(int line, int since) const {
+    for (int i = max(0, since - base), n = edit.size(); i < n && line >= 0; i++) {
+      const Edit &e = edit[i];
+      if      (line > e.line + e.erased) line += e.inserted - e.erased;
+      else if (line > e.line)            line = -1;
+    }
+    return line;
+  }
+
+  // Returns -1 if the line was inserted since.  Sets edited if its text was changed since.
+  int ToPast(int line, int since, bool *edited=nullptr) const {
+    if (edited) *edited = false;
+    for (int i = edit.size() - 1, end = max(0, since - base); i >= end && line >= 0; i--) {
+      const Edit &e = edit[i];
+      if      (line > e.line + e.inserted) line -= e.inserted - e.erased;
+      else if (line > e.line)              line = -1;
+      else if (line == e.line && edited)   *edited = true;
+    }
+    return line;
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_ANNOTATION_STORE_H__
@@ -0,0 +1,279 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <regex>
+#include "core/app/app.h"
+#include "core/ide/ide.h"
+#include "core/ide/syntax.h"
+#include "piece_table.h"
+#include "highlight.h"
+#include "dir_walk.h"
+#include "preamble_cache.h"
+#include "symbol_index.h"
+#include "dfa_regex.h"
+#include "search.h"
+#include "large_file.h"
+#include "diff.h"
+
+namespace LFL {
+DEFINE_string(bench_lines,      "1000,10000,100000,1000000", "Corpus sizes in lines");
+DEFINE_string(bench_out,        "",                          "Write JSON results here instead of stdout");
+DEFINE_string(bench_clang_file, "",                          "Source file to parse and reparse with libclang");
+DEFINE_string(bench_clang_cmd,  "clang -c",                  "Compile command for bench_clang_file");
+DEFINE_int   (bench_keystrokes, 2000,                        "Keystrokes typed per corpus");
+DEFINE_int   (bench_regex_lines, 100000,                     "Largest corpus to run the std::regex comparison on");
+
+Application *app;
+
+struct Samples {
+  vector<long long> us;
+
+  template <class F> void Measure(F f) {
+    Time start = Now();
+    f();
+    us.push_back(chrono::duration_cast<chrono::microseconds>(Now() - start).count());
+  }
+
+  string JSON() const {
+    vector<long long> s = us;
+    sort(s.begin(), s.end());
+    auto pct = [&](double p){ return s.size() ? s[min(s.size() - 1, size_t(p * s.size()))] : 0; };
+    long long total = accumulate(s.begin(), s.end(), 0LL);
+    return StrCat("{\"n\":", s.size(), ",\"p50_us\":", pct(.5), ",\"p90_us\":", pct(.9), ",\"p99_us\":", pct(.99),
+                  ",\"max_us\":", s.size() ? s.back() : 0, ",\"total_us\":", total, "}");
+  }
+};
+
+static long long ProcStatusKB(const char *field) {
+  ifstream in("/proc/self/status");
+  for (string line; getline(in, line); )
+    if (PrefixMatch(line, field)) return atoll(line.c_str() + strlen(field));
+  return -1;
+}
+
+// Deterministic C++-looking text, with a findable needle every 97 lines.
+static string MakeCorpus(int lines) {
+  static const char *body[] = {
+    "  for (int i = 0; i < n; ++i) total += values[i] * scale;",
+    "  // accumulate the weighted sum before normalizing",
+    "  if (!buffer.empty() && buffer.back() == '\\n') buffer.pop_back();",
+    "  string label = StrCat(\"item \", index, \": \", name);",
+    "  return make_pair(first, second);",
+    "  /* block comment describing the next few statements */",
+  };
+  string ret;
+  unsigned seed = 1;
+  for (int i = 0; i < lines; i++) {
+    seed = seed * 1103515245 + 12345;
+    if      (i % 97 == 0) StrAppend(&ret, "int needle_", i, "(int x) {\n");
+    else if (i % 97 == 96) ret += "}\n";
+    else StrAppend(&ret, body[(seed >> 16) % (sizeof(body) / sizeof(body[0]))], "\n");
+  }
+  return ret;
+}
+
+// Token rules shaped like the C++ highlighter's, run per line as separate std::regexes,
+// as app_stdregex_regex does, and as one DFARegex pass.  Find runs needle_[0-9]+7\( per
+// line on each.
+static string BenchRegex(const string &text) {
+  static const vector<string> rules = {
+    "\\b(?:if|else|for|while|return|int|char|void|const|auto|string|struct)\\b",
+    "//.*$", "/\\*[^*]*\\*/", "\"(?:[^\"\\\\]|\\\\.)*\"", "'(?:[^'\\\\]|\\\\.)*'",
+    "\\b[0-9]+(?:\\.[0-9]*)?\\b", "^\\s*#\\s*\\w+", "[A-Za-z_]\\w*(?=\\()" };
+  vector<std::regex> std_rules;
+  for (auto &r : rules) std_rules.emplace_back(r);
+  DFARegex dfa_rules(rules), dfa_find({ "needle_[0-9]+7\\(" });
+  std::regex std_find("needle_[0-9]+7\\(");
+  vector<pair<const char*, const char*>> line;
+  for (const char *b = text.data(), *e = b + text.size(), *p = b; p < e; ) {
+    const char *le = static_cast<const char*>(memchr(p, '\n', e - p));
+    if (!le) le = e;
+    line.emplace_back(p, le);
+    p = le + 1;
+  }
+  Samples std_highlight, dfa_highlight, std_find_lines, dfa_find_lines;
+  long long std_tokens = 0, dfa_tokens = 0, std_found = 0, dfa_found = 0;
+  for (int i = 0; i < 3; i++) {
+    std_highlight.Measure([&](){
+      for (auto &l : line) for (auto &r : std_rules)
+        for (std::cregex_iterator m(l.first, l.second, r), end; m != end; ++m) std_tokens++;
+    });
+    dfa_highlight.Measure([&](){
+      for (auto &l : line) dfa_rules.MatchAll(l.first, l.second, [&](int, int, int){ dfa_tokens++; });
+      for (auto u : dfa_rules.unsupported)
+        for (auto &l : line) for (std::cregex_iterator m(l.first, l.second, std_rules[u]), end; m != end; ++m) dfa_tokens++;
+    });
+    std_find_lines.Measure([&](){ for (auto &l : line) std_found += std::regex_search(l.first, l.second, std_find); });
+    dfa_find_lines.Measure([&](){
+      const char *mb, *me;
+      int id;
+      for (auto &l : line) dfa_found += dfa_find.Find(l.first, l.second, l.first, &mb, &me, &id);
+    });
+  }
+  return StrCat("{\"std_highlight\":", std_highlight.JSON(), ",\"dfa_highlight\":", dfa_highlight.JSON(),
+                ",\"std_tokens\":", std_tokens / 3, ",\"dfa_tokens\":", dfa_tokens / 3,
+                ",\"dfa_unsupported_rules\":", dfa_rules.unsupported.size(),
+                ",\"std_find\":", std_find_lines.JSON(), ",\"dfa_find\":", dfa_find_lines.JSON(),
+                ",\"std_found\":", std_found / 3, ",\"dfa_found\":", dfa_found / 3, "}");
+}
+
+// Lexes lines [b, e) of the editor with the regex highlighter the way the editor's
+// catch-up pass does, from the checkpoint before b, recording checkpoints.
+static void Highlight(Editor *e, SyntaxMatcher *matcher, HighlightCheckpoints *h,
+                      const PieceTable::Snapshot &snap, int b, int end) {
+  DrawableAnnotation annotation;
+  auto cp = h->Seek(b);
+  e->syntax_parsed_line_index = cp.line - 1;
+  e->syntax_parsed_anchor = cp.anchor;
+  auto i = e->file_line.Begin();
+  for (int line = 0; i.ind && line < cp.line; ++line) ++i;
+  for (int line = cp.line; i.ind && line < end; ++i, ++line) {
+    h->Update(line, e->syntax_parsed_anchor);
+    int slot = i.val->annotation_ind;
+    i.val->annotation_ind = 0;
+    matcher->GetLineAnnotation(e, i, snap.Line(line), false, &e->syntax_parsed_line_index, &e->syntax_parsed_anchor, &annotation);
+    i.val->annotation_ind = slot;
+  }
+}
+
+static string BenchCorpus(int lines) {
+  string text = MakeCorpus(lines);
+  Samples load, open, highlight_all, scroll, type, find_literal, find_regex, diff, index, large_file;
+  Editor::SyntaxColors *colors = Singleton<Editor::Base16DefaultDarkSyntaxColors>::Set();
+  RegexCPlusPlusHighlighter highlighter(colors, colors->SetDefaultAttr(0));
+  PieceTable table;
+  shared_ptr<const PieceTable::Snapshot> snap;
+  load.Measure([&](){
+    BufferFile file(text, "bench.cpp");
+    table.Load(String::ToUTF16(file.buf));
+    snap = table.GetSnapshot();
+    snap->File();
+  });
+
+  // Opening a tab, as EditorView::OpenFile does: the view's line map over a BufferFile,
+  // the piece table, and the regex highlighting of the first screen.
+  for (int i = 0; i < 3; i++) open.Measure([&](){
+    Editor view(app->focused, app->focused->default_font, make_unique<BufferFile>(text, "bench.cpp"));
+    view.UpdateMapping(0, true);
+    PieceTable buffer;
+    buffer.Load(String::ToUTF16(view.file->Contents()));
+    HighlightCheckpoints h;
+    Highlight(&view, &highlighter, &h, *buffer.GetSnapshot(), 0, 50);
+  });
+
+  Editor view(app->focused, app->focused->default_font, make_unique<BufferFile>(text, "bench.cpp"));
+  view.UpdateMapping(0, true);
+  highlight_all.Measure([&](){ HighlightCheckpoints h; Highlight(&view, &highlighter, &h, *snap, 0, lines); });
+
+  int pages = max(1, lines / 50);
+  for (int i = 0; i < 200; i++) scroll.Measure([&](){
+    for (int y = (i * 37 % pages) * 50, e = min(lines, y + 50); y < e; y++) snap->Line(y);
+  });
+
+  HighlightCheckpoints highlight;
+  int line = lines / 2, col = 0;
+  for (int i = 0; i < FLAGS_bench_keystrokes; i++) type.Measure([&](){
+    bool newline = col == 40;
+    table.Insert(line, col, newline ? u"\n" : u"x");
+    highlight.Modify(line, newline, 0);
+    if (newline) { line++; col = 0; } else col++;
+    table.GetSnapshot()->Line(line);
+  });
+
+  auto typed_snap = table.GetSnapshot();
+  const string &typed = typed_snap->File()->buf;
+  for (auto &q : vector<pair<string, Samples*>>{ { "needle_97(", &find_literal }, { "needle_[0-9]+7\\(", &find_regex } }) {
+    bool literal = false;
+    string required = TextSearch::RequiredLiteral(q.first, &literal);
+    auto matcher = TextSearch::MakeLineMatcher(literal ? required : q.first, literal);
+    for (int i = 0; i < 5; i++) q.second->Measure([&](){
+      TextSearch::Search(typed.data(), typed.data() + typed.size(), required, matcher, nullptr,
+                         [](int, int, const char*, const char*){});
+    });
+  }
+
+  auto base = LineDiff::HashLines(text.data(), text.data() + text.size());
+  for (int i = 0; i < 5; i++) diff.Measure([&](){
+    auto hashes = LineDiff::HashLines(typed.data(), typed.data() + typed.size());
+    LineDiff::Marks(LineDiff::Diff(base, hashes), hashes.size());
+  });
+
+  SymbolIndex indexer("/dev/null");
+  for (int i = 0; i < 3; i++) index.Measure([&](){ SymbolIndex::FileRecord rec; indexer.IndexText(text, &rec); });
+
+  string fn = StrCat("/tmp/tepidfusion-bench-", getpid(), ".txt");
+  { ofstream out(fn, ios::binary); out << text; }
+  large_file.Measure([&](){
+    LargeFileIndex large(fn);
+    if (!large.Open()) return;
+    vector<thread> workers;
+    for (int c = 0; c < large.Chunks(); c++) workers.emplace_back([&, c](){ large.CountChunk(c); });
+    for (auto &w : workers) w.join();
+    large.FinishCount();
+    large.Slice(large.Lines() / 2, 1000);
+  });
+  unlink(fn.c_str());
+
+  return StrCat("{\"lines\":", lines, ",\"bytes\":", text.size(), ",\"load\":", load.JSON(), ",\"open\":", open.JSON(),
+                ",\"highlight\":", highlight_all.JSON(), ",\"scroll\":", scroll.JSON(),
+                ",\"type\":", type.JSON(), ",\"find_literal\":", find_literal.JSON(), ",\"find_regex\":", find_regex.JSON(),
+                ",\"diff\":", diff.JSON(), ",\"index\":", index.JSON(), ",\"large_file\":", large_file.JSON(),
+                lines <= FLAGS_bench_regex_lines ? StrCat(",\"regex\":", BenchRegex(text)) : string(),
+                ",\"rss_kb\":", ProcStatusKB("VmRSS:"), "}");
+}
+
+static string BenchReparse() {
+  string fn = FLAGS_bench_clang_file, dir = fn.substr(0, DirNameLen(fn));
+  Samples parse, reparse;
+  TranslationUnit::OpenedFiles opened;
+  TranslationUnit tu(fn, StrCat(FLAGS_bench_clang_cmd, " ", fn), dir.size() ? dir : ".");
+  parse.Measure([&](){ tu.Parse(opened); });
+  for (int i = 0; i < 5 && !tu.parse_failed; i++) reparse.Measure([&](){ tu.Reparse(opened); });
+  return StrCat("{\"file\":\"", fn, "\",\"failed\":", tu.parse_failed ? "true" : "false",
+                ",\"parse\":", parse.JSON(), ",\"reparse\":", reparse.JSON(), "}");
+}
+
+}; // namespace LFL
+using namespace LFL;
+
+extern "C" LFApp *MyAppCreate(int argc, const char* const* argv) {
+  FLAGS_enable_video = FLAGS_enable_input = false;
+  app = make_unique<Application>(argc, argv).release();
+  app->focused = app->framework->ConstructWindow(app).release();
+  app->name = "TepidFusionBench";
+  return app;
+}
+
+extern "C" int MyAppMain(LFApp *application) {
+  if (app->Create(__FILE__)) return -1;
+  if (app->Init()) return -1;
+
+  string json = "{\"corpora\":[";
+  istringstream sizes(FLAGS_bench_lines);
+  for (string n; getline(sizes, n, ','); ) {
+    if (atoi(n.c_str()) <= 0) continue;
+    StrAppend(&json, json.back() == '[' ? "" : ",", BenchCorpus(atoi(n.c_str())));
+  }
+  json += "]";
+  if (FLAGS_bench_clang_file.size()) StrAppend(&json, ",\"clang\":", BenchReparse());
+  StrAppend(&json, ",\"peak_rss_kb\":", ProcStatusKB("VmHWM:"), "}\n");
+
+  if (FLAGS_bench_out.empty()) fputs(json.c_str(), stdout);
+  else { ofstream out(FLAGS_bench_out); out << json; }
+  return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_BUILD_OUTPUT_H__
+#define LFL_EDITOR_BUILD_OUTPUT_H__
+namespace LFL {
+
+// Build output handed from the network thread to the frame loop.  Bytes queue in a
+// fixed ring that the frame drains at a bounded rate, dropping the oldest undrained
+// output if the build outruns it.  Diagnostics are picked out as the bytes arrive, so
+// the index is complete even when the ring overflows.  The ring is allocated on the
+// first write, so jobs that print nothing cost nothing.
+struct BuildOutput {
+  struct Diagnostic { string fn, message; int line=0, col=0; bool error=0; };
+  mutex lock;
+  size_t capacity;
+  vector<char> ring;
+  size_t head=0, used=0;
+  long long received=0, dropped=0;
+  string cwd, partial;
+  vector<Diagnostic> diagnostics;
+  int errors=0, warnings=0, current=-1;
+  BuildOutput(size_t C) : capacity(max(size_t(1), C)) {}
+
+  void Reset(const string &dir) {
+    ScopedMutex l(lock);
+    head = used = 0;
+    received = dropped = 0;
+    cwd = dir;
+    partial.clear();
+    diagnostics.clear();
+    errors = warnings = 0;
+    current = -1;
+  }
+
+  // Returns true if the ring was empty, ie the reader needs waking.
+  bool Write(const char *b, size_t n) {
+    ScopedMutex l(lock);
+    bool was_empty = !used;
+    received += n;
+    Parse(b, n);
+    if (ring.empty()) ring.resize(capacity);
+    if (n > ring.size()) { dropped += n - ring.size(); b += n - ring.size(); n = ring.size(); }
+    if (used + n > ring.size()) {
+      size_t drop = used + n - ring.size();
+      head = (head + drop) % ring.size();
+      used -= drop;
+      dropped += drop;
+    }
+    for (size_t tail = (head + used) % ring.size(), k; n; b += k, n -= k, used += k, tail = (tail + k) % ring.size()) {
+      k = min(n, ring.size() - tail);
+      memcpy(&ring[tail], b, k);
+    }
+    return was_empty;
+  }
+
+  // Moves up to max_bytes to out and returns the number still queued.
+  size_t Read(string *out, size_t max_bytes) {
+    ScopedMutex l(lock);
+    for (size_t n = min(used, max_bytes), k; n; n -= k, used -= k, head = (head + k) % ring.size()) {
+      k = min(n, ring.size() - head);
+      out->append(&ring[head], k);
+    }
+    return used;
+  }
+
+  void Finish() {
+    ScopedMutex l(lock);
+    if (partial.size()) ParseLine(partial.data(), partial.data() + partial.size());
+    partial.clear();
+  }
+
+  bool Step(bool prev, Diagnostic *out, int *index, int *total) {
+    ScopedMutex l(lock);
+    if (diagnostics.empty()) return false;
+    int n = diagnostics.size();
+    current = current < 0 ? (prev ? n - 1 : 0) : (current + (prev ? n - 1 : 1)) % n;
+    *out = diagnostics[current];
+    *index = current;
+    *total = n;
+    return true;
+  }
+
+  pair<int, int> Counts() {
+    ScopedMutex l(lock);
+    return make_pair(errors, warnings);
+  }
+
+  string StatsString() {
+    ScopedMutex l(lock);
+    return StrCat("received=", received, " dropped=", dropped, " queued=", used, " errors=", errors, " warnings=", warnings);
+  }
+
+  void Parse(const char *b, size_t n) {
+    for (const char *e = b + n, *nl; b < e; b = nl + 1) {
+      if (!(nl = static_cast<const char*>(memchr(b, '\n', e - b)))) {
+        if (partial.size() < 65536) partial.append(b, e - b);
+        return;
+      }
+      if (partial.empty()) ParseLine(b, nl);
+      else {
+        partial.append(b, nl - b);
+        ParseLine(partial.data(), partial.data() + partial.size());
+        partial.clear();
+      }
+    }
+  }
+
+  // file:line[:col]: error|fatal error|warning: message, as printed by clang and gcc.
+  void ParseLine(const char *b, const char *e) {
+    if (e > b && e[-1] == '\r') e--;
+    if (memchr(b, '\x1b', e - b)) {
+      string clean;
+      for (const char *p = b; p < e; p++) {
+        if (*p != '\x1b') { clean += *p; continue; }
+        if (p + 1 < e && p[1] == '[') for (p += 2; p < e && !isalpha(*p); p++) {}
+      }
+      if (clean.find('\x1b') == string::npos) ParseLine(clean.data(), clean.data() + clean.size());
+      return;
+    }
+    static const char *kind[] = { ": error: ", ": fatal error: ", ": warning: " };
+    const char *p = e, *msg = e;
+    int k = -1;
+    for (int i = 0; i < 3; i++) {
+      const char *f = TextSearch::FindLiteral(b, e, kind[i]);
+      if (f < p) { p = f; msg = f + strlen(kind[i]); k = i; }
+    }
+    if (k < 0) return;
+
+    int num[2] = { 0, 0 }, nums = 0;
+    while (nums < 2) {
+      const char *d = p;
+      while (d > b && isdigit(d[-1])) d--;
+      if (d == p || d == b || d[-1] != ':') break;
+      num[nums++] = atoi(string(d, p).c_str());
+      p = d - 1;
+    }
+    if (!nums || p == b) return;
+    Diagnostic diag;
+    diag.fn = string(b, p);
+    if (diag.fn[0] != '/' && cwd.size()) diag.fn = StrCat(cwd, "/", diag.fn);
+    diag.line = num[nums-1];
+    diag.col = nums == 2 ? num[0] : 1;
+    diag.error = k < 2;
+    diag.message = string(msg, e);
+    (diag.error ? errors : warnings)++;
+    diagnostics.push_back(move(diag));
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_BUILD_OUTPUT_H__
@@ -0,0 +1,92 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LFL_EDITOR_CMAKE_CLIENT_H__
+#define LFL_EDITOR_CMAKE_CLIENT_H__
+namespace LFL {
+
+// Request latency by request type.
+struct RequestLatency {
+  struct Stats { long long count=0; Time total=Time(0), longest=Time(0), last=Time(0); };
+  map<string, Stats> stats;
+
+  void Add(const string &type, Time t) {
+    auto &s = stats[type];
+    s.count++;
+    s.total += t;
+    s.last = t;
+    s.longest = max(s.longest, t);
+  }
+
+  string StatsString() const {
+    auto ms = [](Time t){ return chrono::duration_cast<chrono::milliseconds>(t).count(); };
+    string ret;
+    for (auto &i : stats)
+      StrAppend(&ret, ret.size() ? "\n" : "", i.first, ": count=", i.second.count, " last_ms=", ms(i.second.last),
+                " max_ms=", ms(i.second.longest), " avg_ms=", i.second.count ? ms(i.second.total) / i.second.count : 0);
+    return ret;
+  }
+};
+
+// Makes every CMakeDaemon call, in the order posted, on a thread of its own, so a
+// completion doesn't block the main thread and never overlaps the target queries.  The
+// daemon keeps no documents, so a document is synced by version instead: its text goes
+// with a request only while the buffer's version differs from the one saved, and
+// otherwise the daemon reads the file itself.  Callbacks run on this thread.
+struct CMakeDaemonClient {
+  CMakeDaemon daemon;
+  RequestLatency latency;
+  mutex lock;
+  condition_variable cv;
+  deque<function<void()>> queue;
+  bool done=0;
+  thread worker;
+  CMakeDaemonClient(Window *W) : daemon(W), worker(bind(&CMakeDaemonClient::Run, this)) {}
+
+  virtual ~CMakeDaemonClient() {
+    { ScopedMutex l(lock); done = true; queue.clear(); }
+    cv.notify_one();
+    worker.join();
+  }
+
+  void Post(function<void()> f) {
+    { ScopedMutex l(lock); queue.push_back(move(f)); }
+    cv.notify_one();
+  }
+
+  // The text to send for a document, or none if the snapshot is of the version on disk.
+  static string DocumentText(const shared_ptr<const PieceTable::Snapshot> &snap, int saved_version) {
+    return snap->version == saved_version ? string() : snap->File()->buf;
+  }
+
+  void Run() {
+    for (;;) {
+      function<void()> f;
+      {
+        unique_lock<mutex> l(lock);
+        cv.wait(l, [&](){ return done || queue.size(); });
+        if (done) return;
+        f = move(queue.front());
+        queue.pop_front();
+      }
+      f();
+    }
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_CMAKE_CLIENT_H__
@@ -0,0 +1,101 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_COMPLETION_H__
+#define LFL_EDITOR_COMPLETION_H__
+namespace LFL {
+
+// Subsequence match scored up for hits at the start, at word boundaries and in runs,
+// or -1 if pattern isn't a subsequence of text.  Case is ignored except as a bonus.
+struct FuzzyMatch {
+  static bool Boundary(const string &t, size_t i) {
+    return !i || t[i-1] == '_' || (!isalnum(t[i-1]) && isalnum(t[i])) || (islower(t[i-1]) && isupper(t[i]));
+  }
+
+  static bool Subsequence(const string &pattern, size_t p, const string &text, size_t t) {
+    for (; p < pattern.size(); p++, t++) {
+      while (t < text.size() && tolower(text[t]) != tolower(pattern[p])) t++;
+      if (t >= text.size()) return false;
+    }
+    return true;
+  }
+
+  static int Score(const string &pattern, const string &text) {
+    int score = 0;
+    size_t last = string::npos, t = 0;
+    for (size_t p = 0; p < pattern.size(); p++, t++) {
+      char c = tolower(pattern[p]);
+      size_t first = t;
+      while (t < text.size() && tolower(text[t]) != c) t++;
+      if (t == text.size()) return -1;
+      // Prefer a later boundary hit over a mid-word one, eg "gd" in "get_definition".
+      if (!Boundary(text, t) && t != last + 1)
+        for (size_t u = t + 1; u < text.size(); u++)
+          if (tolower(text[u]) == c && Boundary(text, u) && Subsequence(pattern, p + 1, text, u + 1)) { t = u; break; }
+      score += 1 + (text[t] == pattern[p]) + (t == last + 1 ? 4 : 0) + (Boundary(text, t) ? 6 : 0) + (!t ? 8 : 0);
+      score -= min(int(t - first), 8);
+      last = t;
+    }
+    return score * 16 - min(int(text.size()), 15);
+  }
+};
+
+// Results of one completion request, with their text pulled out once on the worker so
+// filtering never goes back to clang.
+struct CompletionSet {
+  int line, col;
+  shared_ptr<CodeCompletions> source;
+  vector<string> text;
+  CompletionSet(int L, int C, shared_ptr<CodeCompletions> S) : line(L), col(C), source(move(S)) {
+    if (source) for (size_t i = 0, n = source->size(); i < n; i++) text.push_back(source->GetText(i));
+  }
+};
+
+// Shows the members of a CompletionSet matching the typed prefix, best first.  A prefix
+// extending the last one only rescans the previous matches.
+struct FilteredCodeCompletions : public CodeCompletions {
+  shared_ptr<const CompletionSet> set;
+  string prefix;
+  vector<int> match;
+  FilteredCodeCompletions(shared_ptr<const CompletionSet> S) : set(move(S)) {
+    for (int i = 0, n = set->text.size(); i < n; i++) match.push_back(i);
+  }
+
+  size_t size() const { return match.size(); }
+  string GetText(size_t ind) { return set->text[match[ind]]; }
+
+  void Filter(const string &p) {
+    if (p.compare(0, prefix.size(), prefix) || p.size() < prefix.size()) {
+      match.clear();
+      for (int i = 0, n = set->text.size(); i < n; i++) match.push_back(i);
+    }
+    prefix = p;
+    if (p.empty()) return;
+    vector<pair<int, int>> scored;
+    for (auto i : match) {
+      int score = FuzzyMatch::Score(p, set->text[i]);
+      if (score >= 0) scored.emplace_back(-score, i);
+    }
+    sort(scored.begin(), scored.end());
+    match.clear();
+    for (auto &s : scored) match.push_back(s.second);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_COMPLETION_H__
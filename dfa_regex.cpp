@@ -0,0 +1,105 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/app/app.h"
+#include <regex>
+#include "dfa_regex.h"
+
+namespace LFL {
+// Drop-in for app_stdregex_regex.  Patterns DFARegex can compile match on the DFA,
+// leftmost-first like std::regex; the rest, and Match() on patterns with groups, whose submatches
+// callers read, go to std::regex.  A Regex may be shared by threads, so the lazily built
+// DFA is locked.  Each Regex is its own DFA: core's SyntaxMatcher runs its rules one
+// Regex at a time and doesn't hand over the rule list a single DFARegex would take.
+struct DFARegexImpl {
+  mutex lock;
+  DFARegex dfa;
+  unique_ptr<std::regex> fallback;
+  DFARegexImpl(const string &pattern) : dfa(vector<string>{ pattern }) {
+    if (dfa.Empty() || dfa.captures) fallback = make_unique<std::regex>(pattern);
+  }
+
+  // UTF-8, as patterns are, with the UTF-16 offset of each byte and of the end in units.
+  static string Bytes(const String16Piece &text, vector<int> *units) {
+    string ret;
+    ret.reserve(text.len);
+    units->reserve(text.len + 1);
+    for (int i = 0; i < text.len; i++) {
+      unsigned c = text.buf[i];
+      if (c >= 0xd800 && c < 0xdc00 && i + 1 < text.len && text.buf[i+1] >= 0xdc00 && text.buf[i+1] < 0xe000)
+        c = 0x10000 + ((c - 0xd800) << 10) + (text.buf[i+1] - 0xdc00);
+      if      (c < 0x80)    ret += char(c);
+      else if (c < 0x800)   { ret += char(0xc0 | c >> 6);  ret += char(0x80 | (c & 0x3f)); }
+      else if (c < 0x10000) { ret += char(0xe0 | c >> 12); ret += char(0x80 | (c >> 6 & 0x3f)); ret += char(0x80 | (c & 0x3f)); }
+      else { ret += char(0xf0 | c >> 18); ret += char(0x80 | (c >> 12 & 0x3f)); ret += char(0x80 | (c >> 6 & 0x3f)); ret += char(0x80 | (c & 0x3f)); }
+      units->resize(ret.size(), i);
+      if (c >= 0x10000) i++;
+    }
+    units->push_back(text.len);
+    return ret;
+  }
+
+  Regex::Result MatchOne(const char *b, const char *e) {
+    if (dfa.Empty()) {
+      std::cmatch match;
+      if (!std::regex_search(b, e, match, *fallback)) return Regex::Result();
+      return Regex::Result(match.position(0), match.position(0) + match.length(0));
+    }
+    const char *mb, *me;
+    int id;
+    ScopedMutex l(lock);
+    if (!dfa.Find(b, e, b, &mb, &me, &id)) return Regex::Result();
+    return Regex::Result(mb - b, me - b);
+  }
+
+  int Match(const string &text, vector<Regex::Result> *out) {
+    if (fallback) {
+      std::smatch match;
+      if (!std::regex_search(text, match, *fallback)) return 0;
+      for (size_t i = 0; i < match.size(); i++) out->emplace_back(match.position(i), match.position(i) + match.length(i));
+      return 1;
+    }
+    const char *b = text.data(), *e = b + text.size(), *mb, *me;
+    int id;
+    ScopedMutex l(lock);
+    if (!dfa.Find(b, e, b, &mb, &me, &id)) return 0;
+    out->emplace_back(mb - b, me - b);
+    return 1;
+  }
+};
+
+Regex::~Regex() { delete FromVoid<DFARegexImpl*>(impl); }
+Regex::Regex(const string &patternstr) : impl(new DFARegexImpl(patternstr)) {}
+
+Regex::Result Regex::MatchOne(const StringPiece &text) {
+  return impl ? FromVoid<DFARegexImpl*>(impl)->MatchOne(text.buf, text.buf + text.len) : Regex::Result();
+}
+
+Regex::Result Regex::MatchOne(const String16Piece &text) {
+  if (!impl) return Regex::Result();
+  vector<int> units;
+  string bytes = DFARegexImpl::Bytes(text, &units);
+  Regex::Result r = FromVoid<DFARegexImpl*>(impl)->MatchOne(bytes.data(), bytes.data() + bytes.size());
+  return r.begin < 0 || r.end <= 0 ? r : Regex::Result(units[r.begin], units[r.end]);
+}
+
+int Regex::Match(const string &text, vector<Regex::Result> *out) {
+  return impl ? FromVoid<DFARegexImpl*>(impl)->Match(text, out) : -1;
+}
+
+}; // namespace LFL
@@ -0,0 +1,426 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_DFA_REGEX_H__
+#define LFL_EDITOR_DFA_REGEX_H__
+namespace LFL {
+
+// Any number of ECMAScript-style patterns compiled into one Thompson NFA, matched by a
+// DFA whose states are built the first time they're reached.  Matches are leftmost-first,
+// as a backtracking engine finds them, with the patterns tried in order as if joined by
+// |, so a line is tokenized in one pass whatever the number of rules.  The anchored DFA's
+// states are NFA states in priority order, and a thread that matches cuts off the
+// lower priority threads after it, so the last match seen is the one backtracking
+// would have returned.  ^ $ \b \B are resolved in the DFA from the neighbouring bytes.
+// Patterns using backreferences, lookaround, lazy or possessive quantifiers, or classes
+// it doesn't know are listed in unsupported and left out, for the caller to run on a
+// backtracking engine.  Not thread safe: each thread needs its own.
+struct DFARegex {
+  enum { Byte, Split, Match, BOL, EOL, WordBoundary, NotWordBoundary };
+  enum { Dead = -1, Unknown = -2, MaxNFAStates = 1 << 16, MaxDFAStates = 4096 };
+  struct NFAState { int type, set, out, out1; };
+  struct DFAState {
+    vector<int> nfa;
+    bool at_begin, prev_word;
+    int accept_end;
+  };
+  struct Frag { int start; vector<int> outs; };
+  struct Context { bool at_begin, prev_word, at_end, next_word; };
+  // State s goes to next[s * classes + byte_class[c]] on c, and accept[] of the same
+  // index says which pattern matched up to before c.
+  struct DFA {
+    bool unanchored;
+    vector<DFAState> state;
+    vector<int> next, accept;
+    map<pair<int, vector<int>>, int> index;
+    int start[4];
+    DFA(bool U) : unanchored(U) { Reset(); }
+    void Reset() { state.clear(); next.clear(); accept.clear(); index.clear(); fill(start, start + 4, Unknown); }
+  };
+
+  vector<NFAState> nfa;
+  vector<bitset<256>> sets;
+  vector<int> unsupported, mark, pattern_start;
+  unsigned char byte_class[256];
+  int classes=0, mark_generation=0, captures=0, flushes=0;
+  DFA anchored{false}, unanchored{true};
+
+  DFARegex(const vector<string> &patterns) {
+    for (int i = 0, n = patterns.size(); i < n; i++) {
+      size_t states = nfa.size(), set_count = sets.size();
+      int pattern_captures = 0;
+      if (Compile(patterns[i], i, &pattern_captures)) { captures += pattern_captures; continue; }
+      nfa.resize(states);
+      sets.resize(set_count);
+      unsupported.push_back(i);
+    }
+    bitset<256> word;
+    for (int c = 0; c < 256; c++) word[c] = IsWord(c);
+    sets.push_back(word);
+    map<vector<bool>, int> signature;
+    for (int c = 0; c < 256; c++) {
+      vector<bool> sig;
+      for (auto &s : sets) sig.push_back(s[c]);
+      auto it = signature.emplace(move(sig), signature.size()).first;
+      byte_class[c] = it->second;
+    }
+    classes = signature.size();
+    sets.pop_back();
+    mark.resize(nfa.size());
+  }
+
+  bool Empty() const { return pattern_start.empty(); }
+  static bool IsWord(int c) { return isalnum(c) || c == '_'; }
+
+  // Calls out with [begin, end) and the pattern of each match, scanning left to right.
+  template <class F> void MatchAll(const char *b, const char *e, F out) {
+    for (const char *p = b, *mb, *me; p <= e; ) {
+      int id = -1;
+      if (!Find(b, e, p, &mb, &me, &id)) break;
+      out(mb - b, me - b, id);
+      if (me > mb) p = me;
+      else if (mb == e) break;
+      else p = mb + 1;
+    }
+  }
+
+  // The leftmost-first match in [b, e) starting at or after from.
+  bool Find(const char *b, const char *e, const char *from, const char **mb, const char **me, int *id) {
+    if (Empty()) return false;
+    auto B = reinterpret_cast<const unsigned char*>(b), E = reinterpret_cast<const unsigned char*>(e);
+    auto F = reinterpret_cast<const unsigned char*>(from);
+    int earliest = Scan(&unanchored, B, E, F, true, nullptr);
+    if (earliest < 0) return false;
+    for (const unsigned char *s = F; s <= B + earliest; s++) {
+      if (s < E) {
+        int t = Start(&anchored, s == B, s > B && IsWord(s[-1])) * classes + byte_class[*s];
+        if (anchored.next[t] == Dead && anchored.accept[t] < 0) continue;
+      }
+      int end = Scan(&anchored, B, E, s, false, id);
+      if (end < 0) continue;
+      *mb = b + (s - B);
+      *me = b + end;
+      return true;
+    }
+    return false;
+  }
+
+  // Offset of the earliest (first) match end, else of the leftmost-first one, starting
+  // at s, or -1.
+  int Scan(DFA *dfa, const unsigned char *b, const unsigned char *e, const unsigned char *s, bool first, int *id) {
+    int state = Start(dfa, s == b, s > b && IsWord(s[-1])), best = -1;
+    for (const unsigned char *p = s; ; p++) {
+      if (p == e) {
+        int a = dfa->state[state].accept_end;
+        if (a >= 0) { best = p - b; if (id) *id = a; }
+        return best;
+      }
+      int t = state * classes + byte_class[*p], next = dfa->next[t], a;
+      if (next != Unknown) a = dfa->accept[t];
+      else next = Transition(dfa, state, *p, &a);
+      if (a >= 0) { best = p - b; if (id) *id = a; if (first) return best; }
+      if (next == Dead) return best;
+      state = next;
+    }
+  }
+
+  int Start(DFA *dfa, bool at_begin, bool prev_word) {
+    int &s = dfa->start[at_begin * 2 + prev_word];
+    if (s != Unknown && s < int(dfa->state.size())) return s;
+    vector<int> set;
+    ++mark_generation;
+    for (auto p : pattern_start) Closure(p, nullptr, &set);
+    return (s = AddState(dfa, move(set), at_begin, prev_word));
+  }
+
+  // The state after c, and in accept the pattern matching up to before c, or -1.
+  int Transition(DFA *dfa, int from, unsigned char c, int *accept) {
+    const DFAState &s = dfa->state[from];
+    Context ctx{ s.at_begin, s.prev_word, false, IsWord(c) };
+    vector<int> resolved, stepped;
+    ++mark_generation;
+    for (auto n : s.nfa) Closure(n, &ctx, &resolved);
+    *accept = -1;
+    ++mark_generation;
+    for (auto n : resolved) {
+      if (nfa[n].type == Match) { *accept = nfa[n].set; break; }
+      if (nfa[n].type == Byte && sets[nfa[n].set][c]) Closure(nfa[n].out, nullptr, &stepped);
+    }
+    if (dfa->unanchored) for (auto p : pattern_start) Closure(p, nullptr, &stepped);
+    int flushed = flushes, next = stepped.empty() ? Dead : AddState(dfa, move(stepped), false, IsWord(c));
+    if (flushed == flushes) {
+      dfa->next  [from * classes + byte_class[c]] = next;
+      dfa->accept[from * classes + byte_class[c]] = *accept;
+    }
+    return next;
+  }
+
+  // The unanchored DFA only finds where the earliest match ends, for which the order of
+  // its threads doesn't matter, so its states are sorted to share more of them.
+  int AddState(DFA *dfa, vector<int> set, bool at_begin, bool prev_word) {
+    if (dfa->unanchored) sort(set.begin(), set.end());
+    auto key = make_pair(at_begin * 2 + prev_word, set);
+    auto it = dfa->index.find(key);
+    if (it != dfa->index.end()) return it->second;
+    if (dfa->state.size() >= MaxDFAStates) { dfa->Reset(); flushes++; }
+    DFAState s{ move(set), at_begin, prev_word, -1 };
+    Context ctx{ at_begin, prev_word, true, false };
+    vector<int> resolved;
+    ++mark_generation;
+    for (auto n : s.nfa) Closure(n, &ctx, &resolved);
+    for (auto n : resolved) if (nfa[n].type == Match) { s.accept_end = nfa[n].set; break; }
+    dfa->state.push_back(move(s));
+    dfa->next.resize(dfa->next.size() + classes, Unknown);
+    dfa->accept.resize(dfa->accept.size() + classes, -1);
+    return (dfa->index[key] = dfa->state.size() - 1);
+  }
+
+  // Adds the states reachable from n without input.  Assertions are followed if ctx
+  // satisfies them, and kept pending without a ctx.
+  void Closure(int n, const Context *ctx, vector<int> *out) {
+    if (n < 0 || mark[n] == mark_generation) return;
+    mark[n] = mark_generation;
+    const NFAState &s = nfa[n];
+    switch (s.type) {
+      case Split: Closure(s.out, ctx, out); Closure(s.out1, ctx, out); return;
+      case Byte: case Match: out->push_back(n); return;
+      default:
+        if (!ctx) { out->push_back(n); return; }
+        bool wb = ctx->prev_word != ctx->next_word;
+        if ((s.type == BOL && ctx->at_begin) || (s.type == EOL && ctx->at_end) ||
+            (s.type == WordBoundary && wb) || (s.type == NotWordBoundary && !wb)) Closure(s.out, ctx, out);
+        return;
+    }
+  }
+
+  int AddNFA(int type, int set=-1, int out=-1, int out1=-1) {
+    nfa.push_back(NFAState{ type, set, out, out1 });
+    return nfa.size() - 1;
+  }
+
+  void Patch(const vector<int> &outs, int target) {
+    for (auto o : outs) (o & 1 ? nfa[o >> 1].out1 : nfa[o >> 1].out) = target;
+  }
+
+  bool Compile(const string &pattern, int id, int *groups) {
+    Parser p{ this, pattern, 0, groups };
+    Frag f = p.Alternation();
+    if (!p.ok || p.i != pattern.size() || nfa.size() > MaxNFAStates) return false;
+    Patch(f.outs, AddNFA(Match, id));
+    pattern_start.push_back(f.start);
+    return true;
+  }
+
+  struct Parser {
+    DFARegex *re;
+    const string &p;
+    size_t i;
+    int *groups;
+    bool ok=true;
+
+    bool More() const { return ok && i < p.size(); }
+    Frag Fail() { ok = false; return Frag{ -1, {} }; }
+    Frag Epsilon() { int s = re->AddNFA(Split); return Frag{ s, { s << 1 } }; }
+    Frag Assert(int type) { int s = re->AddNFA(type); return Frag{ s, { s << 1 } }; }
+    Frag Set(const bitset<256> &set) {
+      re->sets.push_back(set);
+      int s = re->AddNFA(Byte, re->sets.size() - 1);
+      return Frag{ s, { s << 1 } };
+    }
+
+    Frag Alternation() {
+      Frag f = Concatenation();
+      while (More() && p[i] == '|') {
+        i++;
+        Frag g = Concatenation();
+        f.start = re->AddNFA(Split, -1, f.start, g.start);
+        f.outs.insert(f.outs.end(), g.outs.begin(), g.outs.end());
+      }
+      return f;
+    }
+
+    Frag Concatenation() {
+      Frag f = Epsilon();
+      while (More() && p[i] != '|' && p[i] != ')') {
+        Frag g = Repetition();
+        if (!ok) break;
+        re->Patch(f.outs, g.start);
+        f.outs = move(g.outs);
+      }
+      return f;
+    }
+
+    Frag Repetition() {
+      size_t atom = i;
+      Frag f = Atom();
+      for (bool quantified = false; More(); quantified = true) {
+        char c = p[i];
+        int lo, hi;
+        if      (c == '*') { lo = 0; hi = -1; i++; }
+        else if (c == '+') { lo = 1; hi = -1; i++; }
+        else if (c == '?') { lo = 0; hi =  1; i++; }
+        else if (c == '{') { if (quantified || !Bounds(&lo, &hi)) return Fail(); }
+        else break;
+        if (More() && (p[i] == '?' || p[i] == '+')) return Fail();
+        f = Repeat(f, atom, lo, hi);
+      }
+      return f;
+    }
+
+    bool Bounds(int *lo, int *hi) {
+      size_t j = i + 1, digits = j;
+      while (j < p.size() && isdigit(p[j])) j++;
+      if (j == digits || j >= p.size()) return false;
+      *lo = *hi = atoi(p.c_str() + digits);
+      if (p[j] == ',') {
+        size_t max_digits = ++j;
+        while (j < p.size() && isdigit(p[j])) j++;
+        *hi = j == max_digits ? -1 : atoi(p.c_str() + max_digits);
+      }
+      if (j >= p.size() || p[j] != '}' || *lo > 1000 || (*hi >= 0 && *hi < *lo)) return false;
+      i = j + 1;
+      return true;
+    }
+
+    // Copies of the atom are compiled again from its text.
+    Frag Copy(size_t atom) {
+      size_t end = i;
+      i = atom;
+      Frag f = Atom();
+      i = end;
+      return f;
+    }
+
+    Frag Repeat(Frag f, size_t atom, int lo, int hi) {
+      if (lo == 0 && hi == -1) {
+        int s = re->AddNFA(Split, -1, f.start);
+        re->Patch(f.outs, s);
+        return Frag{ s, { (s << 1) | 1 } };
+      }
+      if (lo == 1 && hi == -1) {
+        int s = re->AddNFA(Split, -1, f.start);
+        re->Patch(f.outs, s);
+        return Frag{ f.start, { (s << 1) | 1 } };
+      }
+      if (lo == 0 && hi == 1) {
+        int s = re->AddNFA(Split, -1, f.start);
+        f.outs.push_back((s << 1) | 1);
+        return Frag{ s, f.outs };
+      }
+      Frag ret = lo ? f : Epsilon();
+      auto append = [&](Frag g){ re->Patch(ret.outs, g.start); ret.outs = move(g.outs); };
+      for (int k = 1; k < lo && ok; k++) append(Copy(atom));
+      if (hi < 0) append(Repeat(Copy(atom), atom, 0, -1));
+      else for (int k = 0; k < hi - lo && ok; k++) append(Repeat(!lo && !k ? f : Copy(atom), atom, 0, 1));
+      if (re->nfa.size() > MaxNFAStates) return Fail();
+      return ret;
+    }
+
+    Frag Atom() {
+      if (!More()) return Fail();
+      char c = p[i++];
+      bitset<256> set;
+      switch (c) {
+        case '(': {
+          if (i < p.size() && p[i] == '?') {
+            if (i + 1 >= p.size() || p[i+1] != ':') return Fail();
+            i += 2;
+          } else ++*groups;
+          Frag f = Alternation();
+          if (!More() || p[i] != ')') return Fail();
+          i++;
+          return f;
+        }
+        case '[':  return Class();
+        case '.':  set.set(); set['\n'] = set['\r'] = 0; return Set(set);
+        case '^':  return Assert(BOL);
+        case '$':  return Assert(EOL);
+        case '\\': {
+          if (i >= p.size()) return Fail();
+          if (p[i] == 'b') { i++; return Assert(WordBoundary); }
+          if (p[i] == 'B') { i++; return Assert(NotWordBoundary); }
+          if (!Escape(&set)) return Fail();
+          return Set(set);
+        }
+        case ')': case '*': case '+': case '?': case '{': case '|': return Fail();
+        default:   set[(unsigned char)c] = 1; return Set(set);
+      }
+    }
+
+    // Reads the escape after a backslash into set.
+    bool Escape(bitset<256> *set) {
+      if (i >= p.size()) return false;
+      char c = p[i++];
+      switch (c) {
+        case 'd': case 'D': for (int k = '0'; k <= '9'; k++) (*set)[k] = 1; break;
+        case 'w': case 'W': for (int k = 0; k < 256; k++) if (IsWord(k)) (*set)[k] = 1; break;
+        case 's': case 'S': for (char k : string(" \t\n\r\f\v")) (*set)[(unsigned char)k] = 1; break;
+        case 'n': (*set)['\n'] = 1; return true;
+        case 't': (*set)['\t'] = 1; return true;
+        case 'r': (*set)['\r'] = 1; return true;
+        case 'f': (*set)['\f'] = 1; return true;
+        case 'v': (*set)['\v'] = 1; return true;
+        case '0': (*set)[0] = 1; return true;
+        case 'x':
+          if (i + 2 > p.size() || !isxdigit(p[i]) || !isxdigit(p[i+1])) return false;
+          (*set)[strtol(p.substr(i, 2).c_str(), nullptr, 16)] = 1;
+          i += 2;
+          return true;
+        default:
+          if (isalnum(c)) return false;
+          (*set)[(unsigned char)c] = 1;
+          return true;
+      }
+      if (isupper(c)) set->flip();
+      return true;
+    }
+
+    Frag Class() {
+      bitset<256> set;
+      bool negate = i < p.size() && p[i] == '^';
+      if (negate) i++;
+      while (i < p.size() && p[i] != ']') {
+        bitset<256> item;
+        int lo = -1;
+        if (p[i] == '[' && i + 1 < p.size() && (p[i+1] == ':' || p[i+1] == '=' || p[i+1] == '.')) return Fail();
+        if (p[i] == '\\') {
+          i++;
+          if (!Escape(&item)) return Fail();
+          if (item.count() == 1) for (int k = 0; k < 256; k++) if (item[k]) lo = k;
+        } else item[lo = (unsigned char)p[i++]] = 1;
+        if (lo >= 0 && i + 1 < p.size() && p[i] == '-' && p[i+1] != ']') {
+          i++;
+          bitset<256> end;
+          int hi = -1;
+          if (p[i] == '\\') { i++; if (!Escape(&end) || end.count() != 1) return Fail(); for (int k = 0; k < 256; k++) if (end[k]) hi = k; }
+          else hi = (unsigned char)p[i++];
+          if (hi < lo) return Fail();
+          for (int k = lo; k <= hi; k++) item[k] = 1;
+        }
+        set |= item;
+      }
+      if (i >= p.size()) return Fail();
+      i++;
+      if (negate) set.flip();
+      return Set(set);
+    }
+  };
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_DFA_REGEX_H__
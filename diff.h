@@ -0,0 +1,167 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_DIFF_H__
+#define LFL_EDITOR_DIFF_H__
+namespace LFL {
+
+// Line diff over 64-bit line hashes.  The common head and tail are trimmed before
+// Myers' O(ND) search, so a few edits in a big file cost about one pass over the hashes.
+struct LineDiff {
+  typedef unsigned long long Hash;
+  typedef pair<size_t, size_t> Span;
+  struct Hunk { int a, a_len, b, b_len; };
+  enum { Unchanged=0, Added=1, Modified=2, Deleted=3 };
+
+  // A trailing newline doesn't start another line.
+  static vector<Hash> HashLines(const char *b, const char *e, vector<Span> *spans=nullptr) {
+    vector<Hash> ret;
+    for (const char *p = b, *nl; p < e; p = nl + 1) {
+      if (!(nl = static_cast<const char*>(memchr(p, '\n', e - p)))) nl = e;
+      ret.push_back(FNV64(p, nl - p));
+      if (spans) spans->emplace_back(p - b, nl - p);
+    }
+    return ret;
+  }
+
+  // Past max_d edits the rest of the middle is reported as one replaced block.
+  static vector<Hunk> Diff(const vector<Hash> &A, const vector<Hash> &B, int max_d=2048) {
+    int n = A.size(), m = B.size(), pre = 0, suf = 0;
+    while (pre < n && pre < m && A[pre] == B[pre]) pre++;
+    while (suf < n - pre && suf < m - pre && A[n-1-suf] == B[m-1-suf]) suf++;
+    const Hash *a = A.data() + pre, *b = B.data() + pre;
+    n -= pre + suf;
+    m -= pre + suf;
+    vector<Hunk> ret;
+    if (!n && !m) return ret;
+    if (!n || !m) return vector<Hunk>{ Hunk{ pre, n, pre, m } };
+
+    int max = min(n + m, max_d), o = max + 1, D = -1;
+    vector<int> v(2 * max + 3, 0);
+    vector<vector<int>> trace;
+    for (int d = 0; d <= max && D < 0; d++) {
+      trace.emplace_back(v.begin() + o - d, v.begin() + o + d + 1);
+      for (int k = -d; k <= d; k += 2) {
+        int x = (k == -d || (k != d && v[o+k-1] < v[o+k+1])) ? v[o+k+1] : v[o+k-1] + 1, y = x - k;
+        while (x < n && y < m && a[x] == b[y]) { x++; y++; }
+        v[o+k] = x;
+        if (x >= n && y >= m) { D = d; break; }
+      }
+    }
+    if (D < 0) return vector<Hunk>{ Hunk{ pre, n, pre, m } };
+
+    vector<pair<int, int>> edits; // (x, y) before the edit; y<0 marks a deletion
+    for (int d = D, x = n, y = m; d > 0; d--) {
+      const vector<int> &V = trace[d];
+      int k = x - y;
+      bool insert = k == -d || (k != d && V[k-1+d] < V[k+1+d]);
+      int prev_k = insert ? k + 1 : k - 1, prev_x = V[prev_k+d], prev_y = prev_x - prev_k;
+      edits.emplace_back(prev_x, insert ? prev_y : -1 - prev_y);
+      x = prev_x;
+      y = prev_y;
+    }
+    for (auto i = edits.rbegin(); i != edits.rend(); ++i) {
+      bool del = i->second < 0;
+      int x = i->first + pre, y = (del ? -1 - i->second : i->second) + pre;
+      if (ret.empty() || ret.back().a + ret.back().a_len != x || ret.back().b + ret.back().b_len != y)
+        ret.push_back(Hunk{ x, 0, y, 0 });
+      if (del) ret.back().a_len++;
+      else     ret.back().b_len++;
+    }
+    return ret;
+  }
+
+  // One mark per line of the new side.  A pure deletion marks the line after it.
+  static vector<char> Marks(const vector<Hunk> &hunks, int lines) {
+    vector<char> ret(lines, Unchanged);
+    for (auto &h : hunks) {
+      if (!h.b_len) { if (lines) ret[min(h.b, lines-1)] = Deleted; continue; }
+      for (int i = h.b, e = min(lines, h.b + h.b_len); i < e; i++) ret[i] = h.a_len ? Modified : Added;
+    }
+    return ret;
+  }
+
+  static string Unified(const string &a_text, const string &b_text, const string &a_name,
+                        const string &b_name, int context=3) {
+    vector<Span> as, bs;
+    auto hunks = Diff(HashLines(a_text.data(), a_text.data() + a_text.size(), &as),
+                      HashLines(b_text.data(), b_text.data() + b_text.size(), &bs));
+    if (hunks.empty()) return "";
+    string ret = StrCat("--- ", a_name, "\n+++ ", b_name, "\n");
+    auto line = [&](char c, const string &t, const Span &s){ ret += c; ret.append(t, s.first, s.second); ret += '\n'; };
+    for (size_t i = 0, j; i < hunks.size(); i = j) {
+      for (j = i + 1; j < hunks.size() && hunks[j].a - (hunks[j-1].a + hunks[j-1].a_len) <= 2 * context; j++) {}
+      const Hunk &first = hunks[i], &last = hunks[j-1];
+      int a0 = max(0, first.a - context), a1 = min(int(as.size()), last.a + last.a_len + context);
+      int b0 = first.b - (first.a - a0), b1 = last.b + last.b_len + (a1 - (last.a + last.a_len));
+      StrAppend(&ret, "@@ -", a0 + (a1 > a0), ",", a1 - a0, " +", b0 + (b1 > b0), ",", b1 - b0, " @@\n");
+      for (int x = a0, k = i; k < int(j); k++) {
+        const Hunk &h = hunks[k];
+        for (; x < h.a; x++) line(' ', a_text, as[x]);
+        for (; x < h.a + h.a_len; x++) line('-', a_text, as[x]);
+        for (int y = h.b; y < h.b + h.b_len; y++) line('+', b_text, bs[y]);
+        if (k == int(j) - 1) for (; x < a1; x++) line(' ', a_text, as[x]);
+      }
+    }
+    return ret;
+  }
+};
+
+// A buffer's line hashes kept current across its edits, so rediffing rehashes only the
+// lines edited since.  Lines here include the empty one after a trailing newline, which
+// Hashes() drops to match HashLines().
+struct LineHashes {
+  vector<LineDiff::Hash> hash;
+  vector<int> dirty;
+  bool valid=0;
+
+  void Reset(vector<LineDiff::Hash> h, int lines) {
+    hash = move(h);
+    hash.resize(lines, FNV64("", 0));
+    dirty.clear();
+    valid = true;
+  }
+
+  void Clear() { hash.clear(); dirty.clear(); valid = false; }
+
+  // At line y, added lines were inserted after it or removed lines after it joined it.
+  void Modify(int y, int added, int removed) {
+    if (!valid) return;
+    if (y < 0 || y + removed >= int(hash.size())) return Clear();
+    for (auto &l : dirty) if (l > y) l = l <= y + removed ? y : l - removed + added;
+    hash.erase(hash.begin() + y + 1, hash.begin() + y + 1 + removed);
+    hash.insert(hash.begin() + y + 1, added, 0);
+    for (int i = 0; i <= added; i++) dirty.push_back(y + i);
+  }
+
+  template <class LineCB> void Rehash(LineCB line) {
+    sort(dirty.begin(), dirty.end());
+    dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+    for (auto y : dirty) { string l = line(y); hash[y] = FNV64(l.data(), l.size()); }
+    dirty.clear();
+  }
+
+  vector<LineDiff::Hash> Hashes() const {
+    vector<LineDiff::Hash> ret(hash);
+    if (ret.size() && ret.back() == FNV64("", 0)) ret.pop_back();
+    return ret;
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_DIFF_H__
@@ -0,0 +1,168 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_DIR_WALK_H__
+#define LFL_EDITOR_DIR_WALK_H__
+namespace LFL {
+
+// .gitignore rules by directory, plus paths ignored outright, ie the build dir.  The
+// last rule matching a path wins, checking the path's own directory's rules last.
+struct IgnoreRules {
+  struct Rule {
+    string pattern;
+    bool negate=0, dir_only=0, anchored=0;
+    bool operator==(const Rule &x) const { return pattern == x.pattern && negate == x.negate && dir_only == x.dir_only && anchored == x.anchored; }
+  };
+  unordered_map<string, vector<Rule>> rules;
+  vector<string> prefix;
+
+  void AddPrefix(string p) {
+    while (p.size() > 1 && p.back() == '/') p.pop_back();
+    if (p.size()) prefix.push_back(move(p));
+  }
+
+  static vector<Rule> Parse(const string &text) {
+    vector<Rule> ret;
+    istringstream in(text);
+    for (string line; getline(in, line); ) {
+      while (line.size() && isspace(line.back())) line.pop_back();
+      if (line.empty() || line[0] == '#') continue;
+      Rule r;
+      if (line[0] == '!') { r.negate = true; line.erase(0, 1); }
+      else if (line[0] == '\\') line.erase(0, 1);
+      if (line.size() && line.back() == '/') { r.dir_only = true; line.pop_back(); }
+      if (line.size() && line[0] == '/') { r.anchored = true; line.erase(0, 1); }
+      if (line.empty()) continue;
+      if (line.find('/') != string::npos) r.anchored = true;
+      r.pattern = line;
+      ret.push_back(r);
+    }
+    return ret;
+  }
+
+  // Shell glob where * and ? stop at /, and ** crosses it.
+  static bool Glob(const char *p, const char *t) {
+    for (; *p; p++, t++) {
+      if (*p == '*') {
+        bool any = p[1] == '*';
+        while (*p == '*') p++;
+        if (any && *p == '/') p++;
+        for (;; t++) {
+          if (Glob(p, t)) return true;
+          if (!*t || (!any && *t == '/')) return false;
+        }
+      }
+      if (!*t || (*t == '/' && *p != '/')) return false;
+      if (*p == '?') continue;
+      if (*p == '[') {
+        const char *c = p + 1;
+        bool negate = *c == '!' || *c == '^', hit = false;
+        if (negate) c++;
+        for (; *c && *c != ']'; c++) {
+          if (c[1] == '-' && c[2] && c[2] != ']') { hit |= *t >= *c && *t <= c[2]; c += 2; }
+          else hit |= *t == *c;
+        }
+        if (!*c || hit == negate) return false;
+        p = c;
+        continue;
+      }
+      if (*p != *t) return false;
+    }
+    return !*t;
+  }
+
+  static const char *BaseName(const string &path) {
+    size_t slash = path.rfind('/');
+    return path.c_str() + (slash == string::npos ? 0 : slash + 1);
+  }
+
+  // Paths are absolute, directories without a trailing slash.
+  bool Ignored(const string &path, bool is_dir) const {
+    const char *base = BaseName(path);
+    if (!strcmp(base, ".git")) return true;
+    for (auto &p : prefix) if (path == p || PrefixMatch(path, StrCat(p, "/"))) return true;
+    int ignored = -1;
+    for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1)) {
+      auto it = rules.find(path.substr(0, slash));
+      if (it == rules.end()) continue;
+      string rel = path.substr(slash + 1);
+      for (auto &r : it->second) {
+        if (r.dir_only && !is_dir) continue;
+        if (Glob(r.pattern.c_str(), r.anchored ? rel.c_str() : base)) ignored = !r.negate;
+      }
+    }
+    return ignored > 0;
+  }
+};
+
+// One directory's entries, less the ignored, directories first then by name.
+struct DirectoryListing {
+  string dir;
+  vector<IgnoreRules::Rule> rules;
+  vector<pair<string, bool>> entry;
+
+  void List(const IgnoreRules &ignore) {
+    ifstream gitignore(StrCat(dir, "/.gitignore"));
+    if (gitignore) rules = IgnoreRules::Parse(string(istreambuf_iterator<char>(gitignore), istreambuf_iterator<char>()));
+    IgnoreRules own;
+    own.rules[dir] = rules;
+    DIR *d = opendir(dir.c_str());
+    if (!d) return;
+    for (struct dirent *e; (e = readdir(d)); ) {
+      string name = e->d_name, path = StrCat(dir, "/", name);
+      if (name == "." || name == "..") continue;
+      bool is_dir = e->d_type == DT_DIR;
+      if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) { struct stat s; is_dir = !stat(path.c_str(), &s) && S_ISDIR(s.st_mode); }
+      if (ignore.Ignored(path, is_dir) || own.Ignored(path, is_dir)) continue;
+      entry.emplace_back(move(name), is_dir);
+    }
+    closedir(d);
+    sort(entry.begin(), entry.end(), [](const pair<string, bool> &a, const pair<string, bool> &b){
+      return a.second != b.second ? a.second : a.first < b.first;
+    });
+  }
+};
+
+// Every regular file under a directory, depth first, less what the ignore rules and each
+// directory's own .gitignore leave out.  Symlinked directories are followed once.
+struct DirectoryWalker {
+  typedef function<void(const string &path, long long size)> FileCB;
+  IgnoreRules ignore;
+  set<pair<long long, long long>> seen;
+  DirectoryWalker(IgnoreRules I=IgnoreRules()) : ignore(move(I)) {}
+
+  void Walk(string dir, const FileCB &cb) {
+    while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+    struct stat s;
+    if (stat(dir.c_str(), &s) || !seen.emplace(s.st_dev, s.st_ino).second) return;
+    DirectoryListing listing;
+    listing.dir = dir;
+    listing.List(ignore);
+    bool own = listing.rules.size() && !ignore.rules.count(dir);
+    if (own) ignore.rules[dir] = listing.rules;
+    for (auto &e : listing.entry) {
+      string path = StrCat(dir, "/", e.first);
+      if (e.second) Walk(path, cb);
+      else if (!stat(path.c_str(), &s) && S_ISREG(s.st_mode)) cb(path, s.st_size);
+    }
+    if (own) ignore.rules.erase(dir);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_DIR_WALK_H__
@@ -0,0 +1,131 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_DIR_WATCH_H__
+#define LFL_EDITOR_DIR_WATCH_H__
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+namespace LFL {
+
+// Watches directories with inotify on a thread of its own, and reports the directories
+// whose entries changed in batches, gathering events for batch_ms after the first.  An
+// overflowed queue reports every watched directory.  A directory deleted or moved away
+// stops being watched and reports its parent.  Without inotify nothing is watched.
+struct DirectoryWatcher {
+  typedef function<void(vector<string>)> BatchCB;
+  BatchCB batch_cb;
+  int batch_ms, fd=-1, stop[2]={-1,-1};
+  mutex lock;
+  unordered_map<int, string> watch;
+  unordered_map<string, int> watch_id;
+  thread worker;
+
+  DirectoryWatcher(BatchCB cb, int ms=100) : batch_cb(move(cb)), batch_ms(ms) {
+#ifdef __linux__
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) { ERROR("inotify_init1: ", strerror(errno)); return; }
+    if (pipe(stop)) { ERROR("pipe: ", strerror(errno)); close(fd); fd = -1; return; }
+    worker = thread(bind(&DirectoryWatcher::Run, this));
+#endif
+  }
+
+  virtual ~DirectoryWatcher() {
+    if (fd < 0) return;
+    if (write(stop[1], "", 1) < 0) ERROR("DirectoryWatcher stop: ", strerror(errno));
+    worker.join();
+    close(stop[0]);
+    close(stop[1]);
+    close(fd);
+  }
+
+  bool Enabled() const { return fd >= 0; }
+  size_t Watches() { ScopedMutex l(lock); return watch.size(); }
+
+  void Watch(const string &dir) {
+#ifdef __linux__
+    if (fd < 0) return;
+    ScopedMutex l(lock);
+    if (watch_id.count(dir)) return;
+    int wd = inotify_add_watch(fd, dir.c_str(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                               IN_DELETE_SELF | IN_MOVE_SELF | IN_CLOSE_WRITE | IN_ONLYDIR);
+    if (wd < 0) return ERROR("inotify_add_watch ", dir, ": ", strerror(errno));
+    watch[wd] = dir;
+    watch_id[dir] = wd;
+#endif
+  }
+
+  void Unwatch(const string &dir) {
+#ifdef __linux__
+    ScopedMutex l(lock);
+    auto it = watch_id.find(dir);
+    if (it == watch_id.end()) return;
+    inotify_rm_watch(fd, it->second);
+    watch.erase(it->second);
+    watch_id.erase(it);
+#endif
+  }
+
+#ifdef __linux__
+  // A watch the kernel dropped, or whose directory went away, is gone from the maps, so
+  // the path can be watched again, and the parent is reported for its entry to change.
+  void Forget(unordered_map<int, string>::iterator w, bool moved, set<string> *changed) {
+    if (moved) inotify_rm_watch(fd, w->first);
+    size_t slash = w->second.rfind('/');
+    if (slash != string::npos) changed->insert(slash ? w->second.substr(0, slash) : "/");
+    auto id = watch_id.find(w->second);
+    if (id != watch_id.end() && id->second == w->first) watch_id.erase(id);
+    watch.erase(w);
+  }
+
+  void Run() {
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    set<string> changed;
+    auto deadline = chrono::steady_clock::now();
+    for (;;) {
+      pollfd p[2] = { { fd, POLLIN, 0 }, { stop[0], POLLIN, 0 } };
+      int timeout = changed.empty() ? -1 : max(0, int(chrono::duration_cast<chrono::milliseconds>
+                                                      (deadline - chrono::steady_clock::now()).count()));
+      if (poll(p, 2, timeout) < 0 && errno != EINTR) { ERROR("poll: ", strerror(errno)); return; }
+      if (p[1].revents) return;
+      if (changed.size() && chrono::steady_clock::now() >= deadline) {
+        batch_cb(vector<string>(changed.begin(), changed.end()));
+        changed.clear();
+      }
+      if (!(p[0].revents & POLLIN)) continue;
+      if (changed.empty()) deadline = chrono::steady_clock::now() + chrono::milliseconds(batch_ms);
+      for (ssize_t len; (len = read(fd, buf, sizeof(buf))) > 0; ) {
+        ScopedMutex l(lock);
+        for (char *b = buf; b < buf + len; ) {
+          auto e = reinterpret_cast<const struct inotify_event*>(b);
+          b += sizeof(struct inotify_event) + e->len;
+          if (e->mask & IN_Q_OVERFLOW) { for (auto &w : watch) changed.insert(w.second); continue; }
+          auto w = watch.find(e->wd);
+          if (w == watch.end()) continue;
+          if (e->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) { Forget(w, e->mask & IN_MOVE_SELF, &changed); continue; }
+          if ((e->mask & IN_CLOSE_WRITE) && strcmp(e->name, ".gitignore")) continue;
+          changed.insert(w->second);
+        }
+      }
+    }
+  }
+#endif
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_DIR_WATCH_H__
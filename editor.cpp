@@ -23,7 +23,28 @@
 #include "core/app/ipc.h"
 #include "core/ide/ide.h"
 #include "core/ide/syntax.h"
-#include "imports/diff-match-patch-cpp-stl/diff_match_patch.h"
+#include "piece_table.h"
+#include "highlight.h"
+#include "tu_scheduler.h"
+#include "dir_walk.h"
+#include "preamble_cache.h"
+#include "symbol_index.h"
+#include "dfa_regex.h"
+#include "search.h"
+#include "large_file.h"
+#include "diff.h"
+#include "build_output.h"
+#include "job_scheduler.h"
+#include "frame_stats.h"
+#include "completion.h"
+#include "cmake_client.h"
+#include "trace.h"
+#include "annotation_store.h"
+#include "dir_watch.h"
+#include "tab_budget.h"
+#include "journal.h"
+#include "session.h"
+#include "undo_log.h"
 
 namespace LFL {
 DEFINE_string(project,         "",              "CMake build dir");
@@ -34,8 +55,29 @@ DEFINE_string(cvs_cmd,         "git",           "CVS command, ie git");
 DEFINE_string(cmake_daemon,    "bin/cmake",     "CMake daemon");
 DEFINE_string(default_project, "",              "Default project");
 DEFINE_bool  (clang,           true,            "Use libclang");
-DEFINE_bool  (clang_highlight, false,           "Use Clang syntax matcher");
+DEFINE_bool  (clang_highlight, true,            "Use Clang syntax matcher");
 DEFINE_bool  (regex_highlight, true,            "Use Regex syntax matcher");
+DEFINE_int   (highlight_checkpoint_interval, 256, "Lines between saved syntax matcher states");
+DEFINE_int   (highlight_slice_ms,            4,   "Idle highlighting budget per frame");
+DEFINE_int   (parse_workers,                 0,   "Concurrent translation unit parses, 0 = half the cores");
+DEFINE_int   (scan_workers,                  0,   "Thread pool workers a Find in Files or large file count may take, 0 = half the pool");
+DEFINE_bool  (preamble_cache,                true, "Cache precompiled preambles in the build dir");
+DEFINE_bool  (symbol_index,                  true, "Index project symbols in the background");
+DEFINE_int   (large_file_mb,                 64,  "Open files this big memory-mapped and read-only, 0 = never");
+DEFINE_int   (large_file_window_lines,       100000, "Lines of a large file materialized around the view");
+DEFINE_int   (build_output_buffer_kb,        1024, "Output queued per job for its console before the oldest is dropped");
+DEFINE_int   (build_jobs,                    0,    "Concurrent build and tidy jobs, 0 = one per core");
+DEFINE_int   (build_output_frame_kb,         256,  "Build output written to the console per frame");
+DEFINE_bool  (frame_skip,                    true, "Skip frames with nothing to redraw");
+DEFINE_bool  (trace,                         false, "Record hot path spans for trace_save");
+DEFINE_int   (memory_budget_mb,              2048, "Memory open tabs may hold before background tabs are evicted, 0 = no limit");
+DEFINE_bool  (session,                       true, "Save the open tabs on exit and restore them, with cached spans, on startup");
+DEFINE_bool  (edit_journal,                  true, "Journal unsaved edits to the build dir and restore them after a crash");
+DEFINE_int   (edit_journal_compact_mb,       16,   "Rewrite the edit journal past this size even while buffers have unsaved edits");
+DEFINE_int   (tu_memory_estimate_mb,         96,   "Memory counted against the budget per parsed translation unit");
+DEFINE_int   (undo_log_kb,                   4096, "Undo history kept in memory per buffer before the oldest is spilled to disk");
+DEFINE_int   (undo_merge_ms,                 1000, "Keystrokes this close together on a line undo as one");
+DEFINE_int   (find_in_files_max_kb,          4096, "Find in Files skips files bigger than this");
 extern FlagOfType<bool> FLAGS_enable_network_;
 
 struct MyApp : public Application {
@@ -44,23 +86,167 @@ struct MyApp : public Application {
   SearchPaths search_paths;
   string build_bin;
   Editor::SyntaxColors *cpp_colors = Singleton<Editor::Base16DefaultDarkSyntaxColors>::Set();
+  StartupTimer startup;
   MyApp(int ac, const char* const* av) : Application(ac, av), search_paths(&localfs, getenv("PATH")), build_bin(search_paths.Find("make")) {}
   void OnWindowInit(Window *W);
   void OnWindowStart(Window *W);
 } *app;
 
 struct MyEditorDialog : public EditorDialog {
-  unique_ptr<TranslationUnit> main_tu, next_tu;
-  vector<DrawableAnnotation> main_annotation, next_annotation;
+  shared_ptr<TranslationUnit> main_tu, next_tu;
+  AnnotationStore main_annotation, tu_annotation, cached_annotation;
+  DrawableAnnotation line_annotation;
+  LineDeltas line_deltas;
+  int main_tu_deltas=-1, cached_deltas=-1, parse_deltas=-1;
   vector<pair<int, int>> find_results;
-  bool parsing=0, needs_reparse=0;
-  int file_type=0, reparsed=0, find_results_ind=0;
+  vector<MappedSymbolIndex::Location> locations;
+  shared_ptr<atomic<bool>> find_cancel;
+  PieceTable buffer;
+  shared_ptr<const PieceTable::Snapshot> snapshot;
+  HighlightCheckpoints highlight;
+  Editor::LineMap::Iterator highlight_line;
+  vector<int> refresh_lines;
+  int highlight_line_version=-1, highlight_line_count=-1;
+  shared_ptr<LargeFileIndex> large_file;
+  long long window_first=0, scroll_pending_line=-1;
+  int scroll_pending_col=0;
+  int window_lines=0, visible_first=-1, visible_last=-1;
+  shared_ptr<const CompletionSet> completions;
+  unique_ptr<UndoLog> undo;
+  int completion_request=0;
+  shared_ptr<const vector<LineDiff::Hash>> diff_base;
+  vector<char> diff_marks;
+  LineHashes line_hashes;
+  int diff_version=-1;
+  bool diffing=0, diff_base_saved=0, evicted=0, text_evicted=0, saving=0, save_pending=0, undoing=0;
+  EditJournal *journal=0;
+  EditJournal::Hash journal_base=0;
+  const int *input_event=0;
+  int file_type=0, reparsed=0, find_results_ind=0, saved_version=0, fresh_tus=0;
   SyntaxMatcher *regex_highlighter=0;
   using EditorDialog::EditorDialog;
   virtual ~MyEditorDialog() {}
+
+  bool Modified() const { return buffer.loaded && buffer.version != saved_version; }
+  void MarkSaved() { saved_version = buffer.version; }
+
+  size_t TUBytes() const { return (size_t(bool(main_tu)) + bool(next_tu)) * (size_t(max(0, FLAGS_tu_memory_estimate_mb)) << 20); }
+  size_t TextBytes() const { return buffer.loaded ? buffer.size * sizeof(char16_t) : 0; }
+  size_t UndoBytes() const { return undo ? undo->Bytes() : 0; }
+  size_t Bytes() const { return TUBytes() + TextBytes() + ViewBytes() + UndoBytes() + main_annotation.Bytes() + tu_annotation.Bytes(); }
+  size_t EvictableBytes() const { return Bytes() - ViewBytes() - UndoBytes() - (Modified() ? TextBytes() : 0); }
+
+  // The core Editor's copy, which eviction keeps: its line map, and the text when the
+  // file is held in memory rather than read from disk.
+  size_t ViewBytes() const {
+    auto file = dynamic_cast<BufferFile*>(view.file.get());
+    return view.file_line.size() * sizeof(Editor::LineOffset) + (file ? file->buf.size() : 0);
+  }
+
+  // Drops whatever selecting the tab again can rebuild: the TUs, the annotations, and
+  // the text if it's saved, leaving the file to load it from.  The view's lines keep
+  // their main_annotation slots, so only the slots' runs go.
+  void Evict() {
+    main_tu.reset();
+    next_tu.reset();
+    main_tu_deltas = -1;
+    main_annotation.ClearRuns();
+    tu_annotation = AnnotationStore();
+    cached_annotation = AnnotationStore();
+    cached_deltas = -1;
+    TrimLineDeltas();
+    if (regex_highlighter) highlight = HighlightCheckpoints(FLAGS_highlight_checkpoint_interval);
+    completions.reset();
+    snapshot.reset();
+    line_hashes.Clear();
+    if (!Modified() && !large_file) {
+      int version = buffer.version;
+      buffer = PieceTable();
+      buffer.version = version;
+      text_evicted = true;
+    }
+    evicted = true;
+  }
+
+  // Loaded when the tab opens, so edits always apply to the text the view was built from.
+  // Once evicted the text is read back from disk, which the view's file may predate.
+  void LoadBuffer() {
+    if (buffer.loaded) return;
+    string text = text_evicted ? LocalFile::FileContents(view.file->Filename()) : view.file->Contents();
+    buffer.Load(String::ToUTF16(text));
+    line_hashes.Clear();
+    MarkSaved();
+    if (!journal) return;
+    journal_base = EditJournal::HashText(text);
+    journal->AddBase(view.file->Filename(), buffer.version, journal_base);
+  }
+
+  void ApplyModification(const Editor::Modification &m) { Modify(m.p.y, m.p.x, m.erase, m.data); }
+
+  void Modify(int y, int x, bool erase, const String16 &data) {
+    LoadBuffer();
+    int lines = count(data.begin(), data.end(), '\n');
+    if (erase) buffer.Erase(y, x, data.size());
+    else       buffer.Insert(y, x, data);
+    if (undo && !undoing) undo->Add(y, x, erase, data, Now(), input_event ? *input_event : -1);
+    if (journal) journal->AddEdit(view.file->Filename(), buffer.version, y, x, erase, String::ToUTF8(data));
+    if (FLAGS_clang && file_type == FileType::CPP) {
+      line_deltas.Add(y, erase ? 0 : lines, erase ? lines : 0);
+      TrimLineDeltas();
+    }
+    highlight.Modify(y, erase ? 0 : lines, erase ? lines : 0);
+    line_hashes.Modify(y, erase ? 0 : lines, erase ? lines : 0);
+  }
+
+  // Keeps the edits back to the oldest of the shown parse, the session's cached spans and
+  // the parse in flight, and none when there's no such parse.  A parse that has fallen
+  // max_edits behind, eg because reparses keep failing, stops being shown.
+  void TrimLineDeltas() {
+    static const int max_edits = 1 << 16;
+    int position = line_deltas.Position(), keep = position;
+    if (main_tu_deltas >= 0 && position - main_tu_deltas > max_edits) { main_tu_deltas = -1; tu_annotation = AnnotationStore(); }
+    if (cached_deltas  >= 0 && position - cached_deltas  > max_edits) { cached_deltas  = -1; cached_annotation = AnnotationStore(); }
+    for (int p : { main_tu_deltas, cached_deltas, parse_deltas }) if (p >= 0) keep = min(keep, p);
+    line_deltas.Trim(keep);
+  }
+
+  // The cursor's line in main_tu, or -1 if it was typed since main_tu was parsed.
+  int MainTULine() const {
+    return main_tu_deltas < 0 ? -1 : line_deltas.ToPast(view.cursor_line_index, main_tu_deltas);
+  }
+
+  const shared_ptr<const PieceTable::Snapshot> &GetSnapshot() {
+    LoadBuffer();
+    if (!snapshot || snapshot->version != buffer.version) snapshot = buffer.GetSnapshot();
+    return snapshot;
+  }
 };
 
 struct EditorView : public View {
+  enum { DamageSource=1, DamageTerminal=2, DamageRightPane=4, DamageOverlay=8, DamageAll=15 };
+  struct PaneState {
+    MyEditorDialog *top=0, *completions=0;
+    int version=-1, cursor_x=-1, cursor_y=-1, first_line=-1, diff_version=-1;
+    long long terminal_bytes=0;
+    Box box;
+  };
+
+  // Sees input before the views do.  Keys can change the source view, the completion
+  // selection or a panel being typed in.  A click or drag can change any pane, while
+  // moving the mouse with no button down changes nothing drawn.
+  struct DamageInput : public InputController {
+    EditorView *view;
+    bool mouse_down=0;
+    DamageInput(EditorView *V) : view(V) {}
+    int SendKeyEvent(InputEvent::Id, bool down) override { view->input_event++; view->Damage(DamageSource | DamageOverlay); return 0; }
+    int SendMouseEvent(InputEvent::Id, const point&, const point&, int down, int) override {
+      view->input_event++;
+      if (down || mouse_down) view->Damage(DamageAll);
+      mouse_down = down;
+      return 0;
+    }
+    int SendWheelEvent(InputEvent::Id, const v2&, const v2&, bool) override { view->Damage(DamageAll); return 0; }
+  };
   static const int init_right_divider_w=224;
   Box top_center_pane, bottom_center_pane, left_pane, right_pane;
   Widget::Divider bottom_divider, right_divider;
@@ -69,21 +255,50 @@ struct EditorView : public View {
   TabbedDialog<MyEditorDialog> source_tabs;
   TabbedDialog<Dialog> project_tabs;
   TabbedDialog<PropertyTreeDialog> options_tabs;
-  DirectoryTreeDialog dir_tree;
+  PropertyTreeDialog dir_tree;
   PropertyTreeDialog targets_tree, options_tree;
   CodeCompletionsViewDialog code_completions;
   MyEditorDialog *code_completions_editor=0;
+  FilteredCodeCompletions *completion_filter=0;
+  typedef vector<pair<string, shared_ptr<const PieceTable::Snapshot>>> OpenedSnapshots;
   unique_ptr<Terminal> build_terminal;
   unique_ptr<MenuViewInterface> file_menu, edit_menu, view_menu;
-  unique_ptr<PanelViewInterface> find_panel, gotoline_panel;
+  unique_ptr<PanelViewInterface> find_panel, findinfiles_panel, gotoline_panel, gotosymbol_panel;
+  shared_ptr<atomic<bool>> findinfiles_cancel;
   vector<MenuItem> source_context_menu, dir_context_menu;
   bool console_animating = 0;
-  ProcessPipe build_process;
-  CMakeDaemon cmakedaemon;
+  JobScheduler jobs;
+  int shown_job=0;
+  CMakeDaemonClient cmake;
   CMakeDaemon::TargetInfo default_project;
+  bool cmake_completing=0;
+  Time cmake_started=Time(0);
   RegexCPlusPlusHighlighter cpp_highlighter;
   RegexCMakeHighlighter cmake_highlighter;
+  TranslationUnitScheduler tu_scheduler;
+  unique_ptr<PreambleCache> preamble_cache;
+  unique_ptr<SymbolIndex> symbol_indexer;
+  shared_ptr<MappedSymbolIndex> symbol_index;
+  unique_ptr<LockFile> journal_lock;
+  unique_ptr<EditJournal> journal;
+  bool indexing=0, index_pending=0, session_saved=0;
+  int input_event=0;
+  vector<string> index_saved;
+  shared_ptr<const IgnoreRules> dir_ignore;
+  unique_ptr<DirectoryWatcher> dir_watcher;
+  unordered_map<string, PropertyTree::Id> dir_node;
+  unordered_map<string, bool> dir_listing;
+  bool dir_tree_changed=0;
+  TabBudget tab_budget;
+  MyEditorDialog *selected_tab=0;
+  vector<string> target_names;
+  bool started=0;
   unique_ptr<FrameWakeupTimer> wakeup_timer;
+  int damage=DamageAll;
+  long long terminal_bytes=0;
+  PaneState last_state;
+  FrameStats frame_stats;
+  bool settings_saving=0;
 
   EditorView(Window *W) : View(W),
     bottom_divider(this, true, 0), right_divider(this, false, init_right_divider_w),
@@ -94,26 +309,37 @@ struct EditorView : public View {
     code_completions(root, app->fonts->Change(root->default_font, 0, *app->cpp_colors->GetFGColor("StatusLine"), *app->cpp_colors->GetBGColor("StatusLine"))),
     source_context_menu(vector<MenuItem>{
       MenuItem{ "", "Go To Brace",      [=]{ GotoMatchingBrace(); root->Wakeup(); }},
-      MenuItem{ "", "Go To Definition", [=]{ GotoDefinition();    root->Wakeup(); }} }),
+      MenuItem{ "", "Go To Definition", [=]{ GotoDefinition();    root->Wakeup(); }},
+      MenuItem{ "", "Find References",  [=]{ FindReferences();    root->Wakeup(); }} }),
     dir_context_menu(vector<MenuItem>{
       MenuItem{ "b", "Build",           [=]{ Build();             root->Wakeup(); }} }),
-    cmakedaemon(root->parent),
+    jobs(FLAGS_build_jobs),
+    cmake(root->parent),
     cpp_highlighter  (app->cpp_colors, app->cpp_colors->SetDefaultAttr(0)),
     cmake_highlighter(app->cpp_colors, app->cpp_colors->SetDefaultAttr(0)),
+    tu_scheduler(FLAGS_parse_workers),
+    tab_budget(size_t(max(0, FLAGS_memory_budget_mb)) << 20),
     wakeup_timer(make_unique<FrameWakeupTimer>(W)) {
  
     file_menu = app->toolkit->CreateMenu(root, "File", vector<MenuItem>{
       MenuItem{"o", "Open",  [=]{ app->ShowSystemFileChooser(1,0,0,[=](const StringVec &a){ Open(a.size()?a[0]:""); W->Wakeup(); }); }},
-      MenuItem{"s", "Save",  [=]{ if (auto t = Top()) t->view.Save(); root->Wakeup(); }},
+      MenuItem{"s", "Save",  [=]{ if (auto t = Top()) Save(t);        root->Wakeup(); }},
       MenuItem{"b", "Build", [=]{ Build();                            root->Wakeup(); }},
-      MenuItem{"",  "Tidy",  [=]{ Tidy();                             root->Wakeup(); }}
+      MenuItem{"",  "Tidy",  [=]{ Tidy();                             root->Wakeup(); }},
+      MenuItem{"",  "Tidy Project",   [=]{ TidyProject();              root->Wakeup(); }},
+      MenuItem{"",  "Cancel Jobs",    [=]{ jobs.CancelAll();           root->Wakeup(); }},
+      MenuItem{"",  "Next Job Output", [=]{ ShowNextJob();             root->Wakeup(); }},
+      MenuItem{"'", "Next Error",     [=]{ GotoBuildDiagnostic(false); root->Wakeup(); }},
+      MenuItem{"",  "Previous Error", [=]{ GotoBuildDiagnostic(true);  root->Wakeup(); }}
     });
 
     edit_menu = app->toolkit->CreateEditMenu(root, {
-      MenuItem{"z", "Undo",  [=]{ if (auto t = Top()) t->view.WalkUndo(true);  root->Wakeup(); }},
-      MenuItem{"y", "Redo",  [=]{ if (auto t = Top()) t->view.WalkUndo(false); root->Wakeup(); }},
+      MenuItem{"z", "Undo",  [=]{ if (auto t = Top()) Undo(t, true);           root->Wakeup(); }},
+      MenuItem{"y", "Redo",  [=]{ if (auto t = Top()) Undo(t, false);          root->Wakeup(); }},
       MenuItem{"f", "Find",  [=]{ Find("");                                    root->Wakeup(); }},
+      MenuItem{"",  "Find in Files", [=]{ FindInFiles("");                     root->Wakeup(); }},
       MenuItem{"g", "Goto",  [=]{ GotoLine("");                                root->Wakeup(); }},
+      MenuItem{"",  "Go To Symbol", [=]{ GotoSymbol("");                       root->Wakeup(); }},
       MenuItem{"", "Diff unsaved", [=]() { DiffUnsavedChanges();               root->Wakeup(); }},
       MenuItem{"", StrCat(FLAGS_cvs_cmd, " diff"), [=]{ DiffCVS();             root->Wakeup(); }}
     });
@@ -134,22 +360,36 @@ struct EditorView : public View {
       PanelItem{ "button:>", Box(240, 20, 40, 20), [=](const string &a){ FindPrevOrNext(false); root->Wakeup(); }}
     });
  
+    findinfiles_panel = app->toolkit->CreatePanel(root, Box(0, 0, 200, 60), "Find in Files", vector<PanelItem>{
+      PanelItem{ "textbox", Box(20, 20, 160, 20), [=](const string &a){ FindInFiles(a); root->Wakeup(); }}
+    });
+ 
     gotoline_panel = app->toolkit->CreatePanel(root, Box(0, 0, 200, 60), "Goto line number", vector<PanelItem>{
       PanelItem{ "textbox", Box(20, 20, 160, 20), [=](const string &a){ GotoLine(a); root->Wakeup(); }}
     });
 
+    gotosymbol_panel = app->toolkit->CreatePanel(root, Box(0, 0, 200, 60), "Go to symbol", vector<PanelItem>{
+      PanelItem{ "textbox", Box(20, 20, 160, 20), [=](const string &a){ GotoSymbol(a); root->Wakeup(); }}
+    });
+
     Activate(); 
     dir_tree.deleted_cb = [&](){ right_divider.size=0; right_divider.changed=1; };
     if (app->project) dir_tree.title_text = "Source";
-    if (app->project) dir_tree.view.Open(StrCat(app->project->source_dir, LocalFileSystem::Slash));
+    if (app->project) OpenDirectoryTree(app->project->source_dir, app->project->build_dir);
     dir_tree.view.InitContextMenu(bind([=](){ app->ShowSystemContextMenu(dir_context_menu); }));
     dir_tree.view.selected_line_clicked_cb = [&](PropertyView *v, PropertyTree::Id id) {
-      if (auto n = v->GetNode(id)) if (n->val.size() && n->val.back() != '/') Open(n->val);
+      auto n = v->GetNode(id);
+      if (!n || n->val.empty()) return;
+      if (n->val.back() != '/') Open(n->val);
+      else ExpandDirectory(n->val.substr(0, n->val.size() - 1), id);
     };
     project_tabs.AddTab(&dir_tree);
     root->view.push_back(&dir_tree);
 
     targets_tree.deleted_cb = [&](){ right_divider.size=0; right_divider.changed=1; };
+    targets_tree.view.selected_line_clicked_cb = [&](PropertyView *v, PropertyTree::Id id) {
+      if (auto n = v->GetNode(id)) if (n->text.size()) Build(n->text);
+    };
     if (app->project) targets_tree.title_text = "Targets";
     project_tabs.AddTab(&targets_tree);
     root->view.push_back(&targets_tree);
@@ -167,30 +407,231 @@ struct EditorView : public View {
     options_tabs.AddTab(&options_tree);
     root->view.push_back(&options_tree);
 
-    code_completions.deleted_cb = [=](){ code_completions_editor = nullptr; };
+    code_completions.deleted_cb = [=](){ code_completions_editor = nullptr; completion_filter = nullptr; };
     root->view.push_back(&code_completions);
 
+    tu_scheduler.start_cb = bind(&EditorView::StartTranslationUnitParse, this, _1);
+    if (app->project && FLAGS_preamble_cache) {
+      string dir = StrCat(app->project->build_dir, LocalFileSystem::Slash, "tepidfusion-preamble", LocalFileSystem::Slash);
+      LocalFile::mkdir(dir, 0755);
+      preamble_cache = make_unique<PreambleCache>
+        (dir, StrCat(FLAGS_llvm_dir, "/bin/clang"), [=](function<void()> f){ app->RunInThreadPool(move(f)); },
+         [=](const string &fn){ app->RunInMainThread([=](){ HandlePreambleBuilt(fn); }); });
+    }
+    if (app->project && FLAGS_symbol_index) {
+      string fn = StrCat(app->project->build_dir, LocalFileSystem::Slash, "tepidfusion.index");
+      symbol_indexer = make_unique<SymbolIndex>(fn);
+      auto mapped = make_shared<MappedSymbolIndex>(fn);
+      if (mapped->Open()) symbol_index = move(mapped);
+      UpdateSymbolIndex();
+    }
+    if (app->project && FLAGS_edit_journal) OpenJournal(StrCat(app->project->build_dir, LocalFileSystem::Slash, "tepidfusion.journal"));
     build_terminal = make_unique<Terminal>(nullptr, root, root->default_font);
     build_terminal->newline_mode = true;
+    jobs.start_cb = bind(&EditorView::StartJob, this, _1);
+    jobs.cancel_cb = [=](JobScheduler::Job *j){ if (j->process) j->process->Signal(SIGTERM); };
 
     if (app->project && !FLAGS_cmake_daemon.empty()) {
-      cmakedaemon.init_targets_cb = [&](){ app->RunInMainThread([&]{
-        targets_tree.view.tree.Clear();
-        PropertyTree::Children target;
-        for (auto &t : cmakedaemon.targets) target.push_back(targets_tree.view.AddNode(nullptr, t.first));
-        targets_tree.view.SetRoot(targets_tree.view.AddNode(nullptr, "", move(target)));
-        targets_tree.view.Reload();
-        targets_tree.view.Redraw();
-        if (!FLAGS_default_project.empty() && !cmakedaemon.GetTargetInfo
-            (FLAGS_default_project, bind(&EditorView::UpdateDefaultProjectProperties, this, _1)))
+      cmake.daemon.init_targets_cb = [=](){ cmake.Post([=](){
+        vector<string> names;
+        for (auto &t : cmake.daemon.targets) names.push_back(t.first);
+        app->RunInMainThread([=](){
+          cmake.latency.Add("targets", Now() - cmake_started);
+          app->startup.Mark("targets");
+          if (names != target_names) SetTargets(move(names));
+        });
+        Time start = Now();
+        if (!FLAGS_default_project.empty() && !cmake.daemon.GetTargetInfo
+            (FLAGS_default_project, [=](const CMakeDaemon::TargetInfo &v){
+              app->RunInMainThread([=](){
+                cmake.latency.Add("target_info", Now() - start);
+                UpdateDefaultProjectProperties(v);
+              });
+            }))
           ERROR("default_project ", FLAGS_default_project, " not found");
       }); };
-      cmakedaemon.Start(app, app->net.get(), app->FileName(FLAGS_cmake_daemon), app->project->build_dir);
+      cmake_started = Now();
+      string bin = app->FileName(FLAGS_cmake_daemon), build_dir = app->project->build_dir;
+      cmake.Post([=](){ cmake.daemon.Start(app, app->net.get(), bin, build_dir); });
     }
   }
 
+  virtual ~EditorView() { SaveSession(); }
+
   MyEditorDialog *Top() { return source_tabs.top; }
 
+  void SetTargets(vector<string> names) {
+    target_names = move(names);
+    targets_tree.view.tree.Clear();
+    PropertyTree::Children target;
+    for (auto &t : target_names) target.push_back(targets_tree.view.AddNode(nullptr, t));
+    targets_tree.view.SetRoot(targets_tree.view.AddNode(nullptr, "", move(target)));
+    targets_tree.view.Reload();
+    targets_tree.view.Redraw();
+    Damage(DamageRightPane);
+  }
+
+  string SessionFile() const { return StrCat(app->project->build_dir, LocalFileSystem::Slash, "tepidfusion.session"); }
+
+  // Tabs are saved least recently selected first, so restoring them in order leaves the
+  // last selected on top.  Modified buffers' spans would not fit the file, so are left out.
+  // Saved once, when the window closes, or failing that when the view is destroyed.
+  void SaveSession() {
+    if (!app->project || !FLAGS_session || session_saved) return;
+    session_saved = true;
+    Session session;
+    vector<pair<long long, MyEditorDialog*>> order;
+    for (auto &f : opened_files) {
+      auto u = tab_budget.last_used.find(f.first);
+      order.emplace_back(u == tab_budget.last_used.end() ? 0 : u->second, f.second.get());
+    }
+    sort(order.begin(), order.end());
+    for (auto &o : order) {
+      MyEditorDialog *d = o.second;
+      Session::Tab t;
+      t.filename = d->view.file->Filename();
+      t.cursor_line = d->window_first + d->view.cursor_line_index;
+      t.cursor_col = d->view.cursor.i.x;
+      t.first_line = d->window_first + d->view.last_first_line;
+      PreambleCache::StatFile(t.filename, &t.size, &t.mtime);
+      if (!d->large_file && !d->Modified()) {
+        DrawableAnnotation a;
+        for (auto &l : VisibleLines(d))
+          if (ClangAnnotationLine(d, l.first, &a) && a.size()) t.annotation.emplace_back(l.first, a);
+      }
+      session.tab.push_back(move(t));
+    }
+    if (auto t = Top()) session.top = t->view.file->Filename();
+    session.targets = target_names;
+    if (FLAGS_default_project.size() && default_project.output.size()) {
+      auto &t = session.default_target;
+      t.name = FLAGS_default_project;
+      t.output = default_project.output;
+      t.compile_definitions = default_project.compile_definitions;
+      t.compile_options = default_project.compile_options;
+      t.include_directories = default_project.include_directories;
+    }
+    if (!session.Save(SessionFile())) ERROR("session save failed");
+  }
+
+  // Shows the last session's tabs and targets as they were.  Each tab's cached spans stand
+  // in for clang's until its first parse lands, and the daemon's targets replace these.
+  // The default target's settings let the first parses of files without a compile
+  // command start before the daemon answers.
+  void RestoreSession() {
+    if (!app->project || !FLAGS_session) return;
+    Session session;
+    if (!session.Load(SessionFile())) return;
+    if (session.targets.size() && target_names.empty()) {
+      SetTargets(session.targets);
+      app->startup.Mark("targets_cached");
+    }
+    auto &target = session.default_target;
+    if (target.name.size() && target.name == FLAGS_default_project && default_project.output.empty()) {
+      default_project.output = target.output;
+      default_project.compile_definitions = target.compile_definitions;
+      default_project.compile_options = target.compile_options;
+      default_project.include_directories = target.include_directories;
+    }
+    for (auto &t : session.tab) {
+      long long size, mtime;
+      if (!PreambleCache::StatFile(t.filename, &size, &mtime)) continue;
+      MyEditorDialog *d = Open(t.filename);
+      if (!d) continue;
+      tab_budget.Touch(t.filename);
+      if (size == t.size && mtime == t.mtime && !d->large_file && t.annotation.size()) {
+        for (auto &a : t.annotation) d->cached_annotation.Set(a.first, a.second);
+        d->cached_deltas = d->line_deltas.Position();
+      }
+      ScrollToLine(d, t.first_line, t.cursor_line, t.cursor_col);
+    }
+    auto top = opened_files.find(session.top);
+    if (top != opened_files.end()) source_tabs.SelectTab(top->second.get());
+    INFO("Restored ", session.tab.size(), " tabs from ", SessionFile());
+    app->startup.Mark("session");
+  }
+
+  // The source tree is listed a directory at a time on the thread pool, as its nodes are
+  // expanded, and a listed directory is relisted when the watcher reports it changed.
+  // Listings land in the tree as they arrive and the view reloads once per frame.
+  void OpenDirectoryTree(string source_dir, string build_dir) {
+    while (source_dir.size() > 1 && source_dir.back() == '/') source_dir.pop_back();
+    while (build_dir .size() > 1 && build_dir .back() == '/') build_dir .pop_back();
+    auto ignore = make_shared<IgnoreRules>();
+    ignore->AddPrefix(build_dir);
+    dir_ignore = move(ignore);
+    dir_watcher = make_unique<DirectoryWatcher>([=](vector<string> dirs){ app->RunInMainThread([=](){
+      for (auto &d : dirs) if (dir_node.count(d)) ListDirectory(d);
+    }); });
+    dir_node.clear();
+    dir_tree.view.tree.Clear();
+    auto id = dir_tree.view.AddNode(nullptr, "", PropertyTree::Children());
+    dir_tree.view.SetRoot(id);
+    ExpandDirectory(source_dir, id);
+  }
+
+  void ExpandDirectory(const string &dir, PropertyTree::Id id) {
+    if (!dir_node.emplace(dir, id).second) return;
+    ListDirectory(dir);
+  }
+
+  void ListDirectory(const string &dir) {
+    auto listing = dir_listing.find(dir);
+    if (listing != dir_listing.end()) { listing->second = true; return; }
+    dir_listing[dir] = false;
+    auto ignore = dir_ignore;
+    app->RunInThreadPool([=](){
+      auto listing = make_shared<DirectoryListing>();
+      listing->dir = dir;
+      listing->List(*ignore);
+      app->RunInMainThread([=](){ HandleDirectoryListing(listing); });
+    });
+  }
+
+  // Merges a listing into its node by name, so expanded subdirectories keep their nodes.
+  void HandleDirectoryListing(const shared_ptr<DirectoryListing> &listing) {
+    const string &dir = listing->dir;
+    bool relist = dir_listing[dir];
+    dir_listing.erase(dir);
+    auto node = dir_node.find(dir);
+    if (node == dir_node.end()) return;
+    auto rules = dir_ignore->rules.find(dir);
+    if (rules == dir_ignore->rules.end() ? listing->rules.size() : rules->second != listing->rules) {
+      auto ignore = make_shared<IgnoreRules>(*dir_ignore);
+      if (listing->rules.size()) ignore->rules[dir] = listing->rules;
+      else ignore->rules.erase(dir);
+      dir_ignore = move(ignore);
+      string prefix = StrCat(dir, "/");
+      for (auto &d : dir_node) if (PrefixMatch(d.first, prefix)) ListDirectory(d.first);
+    }
+
+    unordered_map<string, PropertyTree::Id> existing;
+    for (auto c : dir_tree.view.GetNode(node->second)->child) existing[dir_tree.view.GetNode(c)->text] = c;
+    PropertyTree::Children child;
+    for (auto &e : listing->entry) {
+      auto found = existing.find(e.first);
+      if (found != existing.end()) { child.push_back(found->second); existing.erase(found); continue; }
+      string path = StrCat(dir, "/", e.first);
+      auto id = e.second ? dir_tree.view.AddNode(nullptr, e.first, PropertyTree::Children()) : dir_tree.view.AddNode(nullptr, e.first);
+      dir_tree.view.GetNode(id)->val = e.second ? StrCat(path, "/") : path;
+      child.push_back(id);
+    }
+    for (auto &e : existing) ForgetDirectory(StrCat(dir, "/", e.first));
+    dir_tree.view.GetNode(node->second)->child = move(child);
+    dir_watcher->Watch(dir);
+    dir_tree_changed = true;
+    if (relist) ListDirectory(dir);
+  }
+
+  void ForgetDirectory(const string &dir) {
+    string prefix = StrCat(dir, "/");
+    for (auto i = dir_node.begin(); i != dir_node.end(); /**/) {
+      if (i->first != dir && !PrefixMatch(i->first, prefix)) { ++i; continue; }
+      dir_watcher->Unwatch(i->first);
+      i = dir_node.erase(i);
+    }
+  }
+
   MyEditorDialog *Open(const string &fin) {
     static string prefix = "file://";
     string fn = PrefixMatch(fin, prefix) ? fin.substr(prefix.size()) : fin;
@@ -200,13 +641,47 @@ struct EditorView : public View {
       return opened->second.get();
     }
     INFO("Editor Open ", fn);
+    struct stat s;
+    if (FLAGS_large_file_mb > 0 && !stat(fn.c_str(), &s) && s.st_size >= (long long)(FLAGS_large_file_mb) << 20)
+      return OpenLargeFile(fn);
     return OpenFile(make_unique<LocalFile>(fn, "r"));
   }
 
-  MyEditorDialog *OpenFile(unique_ptr<File> input_file) {
+  // Maps the file and shows a read-only window of it, counting newlines per chunk across
+  // ScanWorkers() pool workers meanwhile.  Until the count lands only the head of the file is shown,
+  // and a scroll past the head waits for it.
+  MyEditorDialog *OpenLargeFile(const string &fn) {
+    auto index = make_shared<LargeFileIndex>(fn);
+    if (!index->Open()) {
+      ERROR("mmap ", fn, " failed");
+      return OpenFile(make_unique<LocalFile>(fn, "r"));
+    }
+    MyEditorDialog *editor = OpenFile(make_unique<BufferFile>(index->Slice(0, FLAGS_large_file_window_lines), fn.c_str()), index);
+    int jobs = min(index->Chunks(), ScanWorkers());
+    auto remaining = make_shared<atomic<int>>(jobs);
+    Time start = Now();
+    for (int job = 0; job < jobs; job++) app->RunInThreadPool([=](){
+      for (int c = job; c < index->Chunks() && index->file.Intact(); c += jobs) index->CountChunk(c);
+      if (--*remaining) return;
+      app->RunInMainThread([=](){
+        if (!index->file.Intact()) { ERROR(fn, " changed on disk while indexing"); return; }
+        index->FinishCount();
+        INFO("indexed ", index->Lines(), " lines of ", fn, " in ", chrono::duration_cast<chrono::milliseconds>(Now() - start).count(), " ms");
+        auto opened = opened_files.find(fn);
+        if (opened == opened_files.end() || opened->second->large_file != index) return;
+        MyEditorDialog *d = opened->second.get();
+        if (d->scroll_pending_line >= 0) ScrollToLine(d, d->scroll_pending_line, d->scroll_pending_col);
+      });
+    });
+    return editor;
+  }
+
+  MyEditorDialog *OpenFile(unique_ptr<File> input_file, shared_ptr<LargeFileIndex> large_file=nullptr) {
     MyEditorDialog *editor = new MyEditorDialog(root, root->default_font, move(input_file), 1, 1); 
     Editor *e = &editor->view;
+    e->readonly = bool(large_file);
     string fn = e->file->Filename();
+    editor->large_file = move(large_file);
     opened_files[fn] = shared_ptr<MyEditorDialog>(editor);
     if      (FileSuffix::CPP(fn))   editor->file_type = FileType::CPP;
     else if (FileSuffix::CMake(fn)) editor->file_type = FileType::CMake;
@@ -218,43 +693,442 @@ struct EditorView : public View {
     child_box.Clear();
 
     e->UpdateMapping(0, FLAGS_regex_highlight);
-    if (app->project && FLAGS_clang) ParseTranslationUnit(FindOrDie(opened_files, e->file->Filename())); 
+    editor->window_lines = e->file_line.size();
+    if (app->project && FLAGS_clang && !editor->large_file) ReparseTranslationUnit(FindOrDie(opened_files, e->file->Filename())); 
+    if (!editor->large_file) {
+      editor->journal = journal.get();
+      editor->input_event = &input_event;
+      editor->undo = make_unique<UndoLog>(size_t(max(0, FLAGS_undo_log_kb)) << 10, Time(chrono::milliseconds(max(0, FLAGS_undo_merge_ms))));
+      editor->LoadBuffer();
+    }
     e->line.SetAttrSource(&e->style);
     e->SetColors(app->cpp_colors);
     e->InitContextMenu(bind([=](){ app->ShowSystemContextMenu(source_context_menu); }));
     e->modified_cb = [=]{ wakeup_timer->WakeupIn(Seconds(1)); };
+    e->modify_cb = bind(&MyEditorDialog::ApplyModification, editor, _1);
     e->newline_cb = bind(&EditorView::IndentNewline, this, editor);
     e->tab_cb = bind(&EditorView::CompleteCode, this);
 
-    if (editor->file_type) {
+    if (editor->file_type || editor->large_file) {
       e->annotation_cb = [=](const Editor::LineMap::Iterator &i, const String16 &t,
                              bool first_line, int check_shift, int shift_offset){
-        if (i.val->annotation_ind < 0) i.val->annotation_ind = PushBackIndex(editor->main_annotation, DrawableAnnotation());
-        if (editor->regex_highlighter) {
-          DrawableAnnotation annotation;
-          if (check_shift) swap(annotation, editor->main_annotation[i.val->annotation_ind]);
-          editor->regex_highlighter->GetLineAnnotation
-            (e, i, t, first_line, &e->syntax_parsed_line_index, &e->syntax_parsed_anchor, &editor->main_annotation[0]);
-          if (annotation.Shifted(editor->main_annotation[i.val->annotation_ind], check_shift, shift_offset)) return NullPointer<DrawableAnnotation>();
-        }
-        return i.val->annotation_ind < 0 ? nullptr : &editor->main_annotation[i.val->annotation_ind];
+        return AnnotateLine(editor, i, t, first_line, check_shift, shift_offset);
       };
-      if (editor->regex_highlighter) {
-        editor->main_annotation.resize(e->file_line.size());
-        // editor->regex_highlighter->UpdateAnnotation(e, &editor->main_annotation[0], editor->main_annotation.size());
-      }
+      if (editor->regex_highlighter)
+        editor->highlight = HighlightCheckpoints(FLAGS_highlight_checkpoint_interval);
     }
 
     if (source_tabs.box.h) e->CheckResized(Box(source_tabs.box.w, source_tabs.box.h-source_tabs.tab_dim.y));
-    editor->deleted_cb = [=](){ source_tabs.DelTab(editor); child_box.Clear(); opened_files.erase(fn); };
+    editor->deleted_cb = [=](){
+      if (editor->journal) editor->journal->AddClosed(fn);
+      source_tabs.DelTab(editor); child_box.Clear(); opened_files.erase(fn); tu_scheduler.Cancel(fn); tab_budget.Forget(fn);
+      CompactJournal();
+    };
     return editor;
   }
 
-  TranslationUnit::OpenedFiles MakeOpenedFilesVector() const {
-    TranslationUnit::OpenedFiles opened;
+  DrawableAnnotation *AnnotateLine(MyEditorDialog *editor, const Editor::LineMap::Iterator &i, const String16 &t,
+                                   bool first_line, int check_shift, int shift_offset) {
+    Editor *e = &editor->view;
+    if (editor->large_file) {
+      int line = i.GetIndex();
+      editor->visible_first = editor->visible_first < 0 ? line : min(editor->visible_first, line);
+      editor->visible_last = max(editor->visible_last, line);
+      if (!editor->file_type) return nullptr;
+    }
+    if (editor->regex_highlighter) {
+      int line = i.GetIndex();
+      if (line != e->syntax_parsed_line_index + 1) {
+        auto cp = editor->highlight.Seek(line);
+        e->syntax_parsed_line_index = cp.line - 1;
+        e->syntax_parsed_anchor = cp.anchor;
+      }
+      DrawableAnnotation annotation;
+      if (check_shift) editor->main_annotation.Get(i.val->annotation_ind, &annotation);
+      if (!check_shift && editor->refresh_lines.size() && i.val->annotation_ind >= 0 &&
+          !binary_search(editor->refresh_lines.begin(), editor->refresh_lines.end(), line) &&
+          !editor->highlight.Pending(line)) {
+        editor->main_annotation.Get(i.val->annotation_ind, &editor->line_annotation);
+        ClangAnnotationLine(editor, line, &editor->line_annotation);
+        return &editor->line_annotation;
+      }
+      TRACE_SPAN("RegexHighlightLine");
+      RegexAnnotateLine(editor, i, t, first_line);
+      if (annotation.Shifted(editor->line_annotation, check_shift, shift_offset)) return NullPointer<DrawableAnnotation>();
+    } else editor->line_annotation.clear();
+    ClangAnnotationLine(editor, i.GetIndex(), &editor->line_annotation);
+    return &editor->line_annotation;
+  }
+
+  // The clang spans to show for line: the latest parse's, else the last session's.
+  bool ClangAnnotationLine(MyEditorDialog *d, int line, DrawableAnnotation *out) {
+    int tu_line = TUAnnotationLine(d, d->tu_annotation, d->main_tu_deltas, line);
+    if (tu_line >= 0) { d->tu_annotation.Get(tu_line, out); return true; }
+    tu_line = TUAnnotationLine(d, d->cached_annotation, d->cached_deltas, line);
+    if (tu_line < 0 || !d->cached_annotation.slot_size[tu_line]) return false;
+    d->cached_annotation.Get(tu_line, out);
+    return true;
+  }
+
+  int VisibleRows(MyEditorDialog *d) {
+    return (source_tabs.box.top() - source_tabs.tab_dim.y - source_tabs.box.y) / d->view.style.font->Height();
+  }
+
+  // The lines on screen and the rows each takes, from the view's line map, since a
+  // wrapped line takes more than one row.
+  vector<pair<int, int>> VisibleLines(MyEditorDialog *d) {
+    Editor *e = &d->view;
+    vector<pair<int, int>> ret;
+    int rows = VisibleRows(d);
+    for (auto i = e->file_line.LowerBound(e->last_first_line); i.ind && rows > 0; ++i) {
+      int n = max(1, i.val->wrapped_lines);
+      ret.emplace_back(i.GetIndex(), n);
+      rows -= n;
+    }
+    return ret;
+  }
+
+  int LastVisibleLine(MyEditorDialog *d) {
+    auto lines = VisibleLines(d);
+    return lines.size() ? lines.back().first : d->view.last_first_line;
+  }
+
+  // The line of a clang annotation generation to show for line, or -1 if it was edited
+  // since that parse, in which case the regex annotation stands.
+  int TUAnnotationLine(MyEditorDialog *d, const AnnotationStore &a, int deltas, int line) {
+    if (deltas < 0 || !a.Slots()) return -1;
+    bool edited = false;
+    int tu_line = d->line_deltas.ToPast(line, deltas, &edited);
+    return (edited || tu_line >= a.Slots()) ? -1 : tu_line;
+  }
+
+  // The visible lines that show differently with annotation a from the parse at deltas
+  // than with b from the parse at b_deltas.
+  vector<int> TUAnnotationChanged(MyEditorDialog *d, const AnnotationStore &a, int deltas, const AnnotationStore &b, int b_deltas) {
+    vector<int> ret;
+    for (auto &l : VisibleLines(d)) {
+      int x = TUAnnotationLine(d, a, deltas, l.first), y = TUAnnotationLine(d, b, b_deltas, l.first);
+      if ((x < 0) != (y < 0) || (x >= 0 && !a.Equal(x, b, y))) ret.push_back(l.first);
+    }
+    return ret;
+  }
+
+  // Relays out the view with only lines relexed.  The rest keep the regex spans they
+  // were last lexed with, which are current above the first edit and the frontier.
+  void RefreshLines(MyEditorDialog *d, vector<int> lines) {
+    d->refresh_lines = move(lines);
+    d->view.RefreshLines();
+    d->refresh_lines.clear();
+    d->view.Redraw();
+    Damage(DamageSource);
+  }
+
+  // Lexes one line into line_annotation and the line's slot of main_annotation.  The
+  // matcher takes an array and writes out[i.val->annotation_ind], the one element it
+  // touches, which is why the baseline passed &main_annotation[0].  With the index set
+  // to 0 for the call, out and &out[0] are both the scratch.
+  void RegexAnnotateLine(MyEditorDialog *d, const Editor::LineMap::Iterator &i, const String16 &t, bool first_line) {
+    Editor *e = &d->view;
+    if (i.val->annotation_ind < 0) i.val->annotation_ind = d->main_annotation.AddSlot();
+    int slot = i.val->annotation_ind;
+    i.val->annotation_ind = 0;
+    d->regex_highlighter->GetLineAnnotation
+      (e, i, t, first_line, &e->syntax_parsed_line_index, &e->syntax_parsed_anchor, &d->line_annotation);
+    i.val->annotation_ind = slot;
+    AnnotationStore::Pack(&d->line_annotation);
+    d->main_annotation.Set(slot, d->line_annotation);
+  }
+
+  // Lexes forward from the first edited line in slices between frames, recording
+  // checkpoints, until the state lines up with a checkpoint from before the edit, and
+  // from the frontier as far as the view shows.  The line iterator is kept across
+  // slices while the buffer and its line map are unchanged, so a slice resumes in place.
+  void UpdateHighlighting(MyEditorDialog *d, Time budget) {
+    TRACE_SPAN("UpdateHighlighting");
+    Editor *e = &d->view;
+    auto &h = d->highlight;
+    auto snap = d->GetSnapshot();
+    int last = LastVisibleLine(d);
+    bool resume = h.scan_line >= 0 && d->highlight_line_version == d->buffer.version &&
+      d->highlight_line_count == int(e->file_line.size());
+    h.Start();
+    auto &i = d->highlight_line;
+    if (!resume) {
+      i = e->file_line.Begin();
+      for (int line = 0; i.ind && line < h.scan_line; ++line) ++i;
+    }
+    d->highlight_line_version = d->buffer.version;
+    d->highlight_line_count = e->file_line.size();
+    Time deadline = Now() + budget;
+    for (int n = 1; i.ind; ++i, ++n) {
+      if (!h.Continue(last)) return FinishHighlighting(d);
+      e->syntax_parsed_line_index = h.scan_line - 1;
+      e->syntax_parsed_anchor = h.scan_anchor;
+      RegexAnnotateLine(d, i, snap->Line(h.scan_line), false);
+      h.scan_anchor = e->syntax_parsed_anchor;
+      h.scan_line++;
+      if (!(n % 64) && Now() > deadline) { ++i; return; }
+    }
+    h.Done();
+    FinishHighlighting(d);
+  }
+
+  void FinishHighlighting(MyEditorDialog *d) {
+    Editor *e = &d->view;
+    e->RefreshLines();
+    e->Redraw();
+    Damage(DamageSource);
+  }
+
+  // Replaces the editor contents with the lines of a large file starting at first.
+  void LoadWindow(MyEditorDialog *d, long long first) {
+    Editor *e = &d->view;
+    LargeFileIndex *index = d->large_file.get();
+    if (!index->file.Intact()) { ERROR(index->file.filename, " changed on disk, reopen it"); return; }
+    first = index->counted ? max(0LL, min(first, index->Lines() - FLAGS_large_file_window_lines)) : 0;
+    e->Init(make_unique<BufferFile>(index->Slice(first, FLAGS_large_file_window_lines), index->file.filename.c_str()));
+    e->UpdateMapping(0, FLAGS_regex_highlight);
+    d->window_first = first;
+    d->window_lines = e->file_line.size();
+    d->visible_first = d->visible_last = -1;
+    d->buffer = PieceTable();
+    d->snapshot.reset();
+    d->line_hashes.Clear();
+    d->main_annotation.Clear();
+    d->line_deltas = LineDeltas();
+    if (d->regex_highlighter) d->highlight = HighlightCheckpoints(FLAGS_highlight_checkpoint_interval);
+    e->RefreshLines();
+    e->Redraw();
+    Damage(DamageSource);
+  }
+
+  // Slides the window of a large file once the view gets near either end of it.
+  void SlideWindow(MyEditorDialog *d) {
+    int margin = FLAGS_large_file_window_lines / 4, first = d->visible_first, last = d->visible_last;
+    d->visible_first = d->visible_last = -1;
+    if (!d->large_file->counted) return;
+    bool up = first < margin && d->window_first > 0;
+    bool down = last >= d->window_lines - margin && d->window_first + d->window_lines < d->large_file->Lines();
+    if (!up && !down) return;
+    long long top = d->window_first + first;
+    LoadWindow(d, top - FLAGS_large_file_window_lines / 2);
+    d->view.ScrollTo(top - d->window_first, 0);
+  }
+
+  // Applies the next step of the tab's undo log through the view, as edits at the cursor
+  // that stay out of the editor's own history.  The buffer, journal and reparse follow
+  // through modify_cb as they do for typing.  Large files keep the editor's own history.
+  void Undo(MyEditorDialog *d, bool undo) {
+    if (!d->undo) return d->view.WalkUndo(undo);
+    vector<UndoLog::Change> changes;
+    if (!(undo ? d->undo->Undo(&changes) : d->undo->Redo(&changes))) return;
+    Editor *e = &d->view;
+    d->undoing = true;
+    for (auto &c : changes) {
+      if (!c.erase) {
+        e->ScrollTo(c.y, c.x);
+        for (auto ch : c.text) e->Modify(ch, false, true);
+        continue;
+      }
+      // Erases by backspacing from the end of the text.
+      auto last = find(c.text.rbegin(), c.text.rend(), '\n');
+      int lines = count(c.text.begin(), c.text.end(), '\n');
+      e->ScrollTo(c.y + lines, lines ? last - c.text.rbegin() : c.x + c.text.size());
+      for (size_t i = 0; i < c.text.size(); i++) e->Modify(0, true, true);
+    }
+    d->undoing = false;
+    e->ScrollTo(changes.back().y, changes.back().x);
+    Damage(DamageSource);
+  }
+
+  void ScrollToLine(MyEditorDialog *d, long long line, int col) {
+    if (d->large_file) {
+      d->scroll_pending_line = -1;
+      if (!d->large_file->counted && line >= d->window_lines) {
+        d->scroll_pending_line = line;
+        d->scroll_pending_col = col;
+        return d->view.ScrollTo(max(0, d->window_lines - 1), 0);
+      }
+      if (line < d->window_first || line >= d->window_first + d->window_lines)
+        LoadWindow(d, line - FLAGS_large_file_window_lines / 2);
+      if (line < d->window_first || line >= d->window_first + d->window_lines) return;
+    }
+    d->view.ScrollTo(line - d->window_first, col);
+  }
+
+  // Puts first at the top of the view, then the cursor at line and col, scrolling again
+  // only if that's off screen.
+  void ScrollToLine(MyEditorDialog *d, long long first, long long line, int col) {
+    ScrollToLine(d, first, 0);
+    int row = 0;
+    for (auto &l : VisibleLines(d)) {
+      if (d->window_first + l.first == line) {
+        d->view.cursor.i = point(col, row);
+        d->view.UpdateCursorLine();
+        d->view.UpdateCursor();
+        return;
+      }
+      row += l.second;
+    }
+    ScrollToLine(d, line, col);
+  }
+
+  // Writes a snapshot of the buffer on the thread pool.  Saves asked for while one is
+  // being written coalesce into one more, of the text as it is when that one lands.
+  void Save(MyEditorDialog *d) {
+    if (d->large_file) { ERROR(d->large_file->file.filename, " is open read-only"); return; }
+    if (d->saving) { d->save_pending = true; return; }
+    d->saving = true;
+    d->save_pending = false;
+    string fn = d->view.file->Filename();
+    auto editor = FindOrDie(opened_files, fn);
+    auto snap = d->GetSnapshot();
+    bool diff_base = d->diff_base_saved;
+    app->RunInThreadPool([=](){
+      const string &text = snap->File()->buf;
+      bool ok = AtomicFile::Write(fn, text);
+      EditJournal::Hash hash = EditJournal::HashText(text);
+      shared_ptr<const vector<LineDiff::Hash>> base;
+      if (ok && diff_base) base = make_shared<const vector<LineDiff::Hash>>(LineDiff::HashLines(text.data(), text.data() + text.size()));
+      app->RunInMainThread([=](){ HandleSaveDone(editor, snap->version, ok, hash, base); });
+    });
+  }
+
+  void HandleSaveDone(shared_ptr<MyEditorDialog> d, int version, bool ok, EditJournal::Hash hash,
+                      shared_ptr<const vector<LineDiff::Hash>> base) {
+    string fn = d->view.file->Filename();
+    d->saving = false;
+    if (!ok) ERROR("Save ", fn, " failed");
+    else {
+      INFO("Saved ", fn);
+      d->saved_version = version;
+      if (d->journal) d->journal->AddSaved(fn, version, (d->journal_base = hash));
+      if (base && d->diff_base_saved) SetDiffBase(d.get(), base, true);
+      if (symbol_indexer) UpdateSymbolIndex(fn);
+      CompactJournal();
+    }
+    auto opened = opened_files.find(fn);
+    if (d->save_pending && opened != opened_files.end() && opened->second == d) Save(d.get());
+  }
+
+  // Once no buffer has unsaved edits, or the journal passes edit_journal_compact_mb, the
+  // journal is rewritten as just what recovery needs: each open buffer's base, and the
+  // text of each modified one.
+  void CompactJournal() {
+    if (!journal) return;
+    bool modified = false;
+    for (auto &f : opened_files) if (f.second->journal && f.second->Modified()) modified = true;
+    long long size = journal->Size();
+    if (modified && size < (long long)(max(1, FLAGS_edit_journal_compact_mb)) << 20) return;
+    string records;
+    for (auto &f : opened_files) {
+      MyEditorDialog *d = f.second.get();
+      if (!d->journal || !d->buffer.loaded) continue;
+      if (d->Modified()) records += EditJournal::Record(EditJournal::Recovered, f.first, d->buffer.version, d->journal_base, 0, 0, d->GetSnapshot()->File()->buf);
+      else               records += EditJournal::Record(EditJournal::Base,      f.first, d->buffer.version, d->journal_base);
+    }
+    if (records.size() < size) journal->Compact(move(records));
+  }
+
+  // Buffers the last session left unsaved are reopened from the old journal, and carried
+  // into the new one before anything else is written to it.  Another instance open on the
+  // same build dir holds the journal's lock, and this one goes without.
+  void OpenJournal(const string &fn) {
+    journal_lock = make_unique<LockFile>(StrCat(fn, ".lock"));
+    if (!journal_lock->locked) { INFO("journal: ", fn, " is in use by another instance, not journaling"); return; }
+    auto recovered = EditJournal::Recover(fn);
+    string records;
+    for (auto &r : recovered) records += EditJournal::Record(EditJournal::Recovered, r.filename, 1, r.base, 0, 0, r.text);
+    if (!AtomicFile::Write(fn, records)) return;
+    vector<MyEditorDialog*> opened;
+    for (auto &r : recovered) {
+      INFO("Recovered unsaved changes to ", r.filename);
+      opened.push_back(OpenFile(make_unique<BufferFile>(r.text, r.filename.c_str())));
+    }
+    journal = make_unique<EditJournal>(fn);
+    for (size_t i = 0; i < opened.size(); i++) {
+      opened[i]->journal = journal.get();
+      opened[i]->journal_base = recovered[i].base;
+      opened[i]->saved_version = -1;
+    }
+  }
+
+  // The whole project is listed once, when the index is opened.  After that each save
+  // re-indexes only the saved files.
+  void UpdateSymbolIndex(const string &saved=string()) {
+    if (saved.size()) index_saved.push_back(saved);
+    if (indexing) { index_pending = true; return; }
+    indexing = true;
+    index_pending = false;
+    vector<string> refresh;
+    swap(refresh, index_saved);
+    const IDEProject *project = app->project.get();
+    app->RunInThreadPool([=](){
+      Time start = Now();
+      if (!symbol_indexer->loaded) {
+        MappedSymbolIndex existing(symbol_indexer->filename);
+        if (existing.Open()) symbol_indexer->Load(existing);
+        else symbol_indexer->loaded = true;
+      }
+      int updated = refresh.size() ? symbol_indexer->Refresh(refresh) : symbol_indexer->Update(SymbolIndex::GetSources(*project, true));
+      auto mapped = make_shared<MappedSymbolIndex>(symbol_indexer->filename);
+      if (updated > 0 && !mapped->Open()) mapped.reset();
+      app->RunInMainThread([=](){
+        if (updated < 0) ERROR("write ", symbol_indexer->filename, " failed");
+        else if (updated) INFO("indexed ", updated, " files in ", chrono::duration_cast<chrono::milliseconds>(Now() - start).count(), " ms");
+        if (mapped && updated > 0) symbol_index = mapped;
+        indexing = false;
+        if (index_pending) UpdateSymbolIndex();
+      });
+    });
+  }
+
+  static bool IdentifierChar(char16_t c) { return c < 0x80 && (isalnum(c) || c == '_'); }
+
+  // The cursor's column counts UTF-16 units, so the line is scanned before converting.
+  string IdentifierAtCursor(MyEditorDialog *d) {
+    String16 text = d->GetSnapshot()->Line(d->view.cursor_line_index);
+    int x = min(int(text.size()), d->view.cursor.i.x), b = x, e = x;
+    while (b > 0 && IdentifierChar(text[b-1])) b--;
+    while (e < int(text.size()) && IdentifierChar(text[e])) e++;
+    return String::ToUTF8(text.substr(b, e-b));
+  }
+
+  void ShowLocations(const vector<MappedSymbolIndex::Location> &loc, const string &title) {
+    if (loc.empty()) return;
+    if (loc.size() == 1) {
+      if (auto editor = Open(loc[0].fn)) ScrollToLine(editor, loc[0].line-1, loc[0].col-1);
+      return;
+    }
+    string text;
+    for (auto &l : loc) StrAppend(&text, l.fn, ":", l.line, ":", l.col, ": ", SymbolIndex::KindName(l.kind), " ",
+                                  l.scope, l.scope.size() ? "::" : "", l.name, "\n");
+    OpenLocations(text, title, loc);
+  }
+
+  // A Find in Files or Find References tab, whose lines Go To Definition follows.
+  void OpenLocations(const string &text, const string &title, vector<MappedSymbolIndex::Location> loc) {
+    if (auto d = OpenFile(make_unique<BufferFile>(text, title.c_str()))) d->locations = move(loc);
+  }
+
+  bool GotoLocation(MyEditorDialog *d) {
+    int line = d->view.cursor_line_index;
+    if (line < 0 || line >= int(d->locations.size())) return false;
+    auto l = d->locations[line];
+    if (auto editor = Open(l.fn)) ScrollToLine(editor, l.line-1, l.col-1);
+    return true;
+  }
+
+  OpenedSnapshots MakeOpenedFilesVector() const {
+    OpenedSnapshots opened;
     for (auto &i : opened_files)
-      if (i.second->view.CacheModifiedText())
-        opened.emplace_back(i.first, i.second->view.cached_text);
+      if (i.second->Modified() && !i.second->large_file) opened.emplace_back(i.first, i.second->GetSnapshot());
+    return opened;
+  }
+
+  static TranslationUnit::OpenedFiles MaterializeOpenedFiles(const OpenedSnapshots &in) {
+    TranslationUnit::OpenedFiles opened;
+    for (auto &i : in) opened.emplace_back(i.first, i.second->File());
     return opened;
   }
 
@@ -274,29 +1148,112 @@ struct EditorView : public View {
     if (!child_box.Size()) child_box.PushNop();
   }
 
+  void Damage(int panes) { damage |= panes; }
+
+  // Damage marked since the last frame, from input and from the code changing a pane,
+  // plus what differs from the last drawn frame.  Hovering leaves the frame undamaged.
+  int TakeDamage(MyEditorDialog *d) {
+    PaneState s;
+    if ((s.top = d)) {
+      s.version = d->buffer.version;
+      s.cursor_x = d->view.cursor.i.x;
+      s.cursor_y = d->view.cursor_line_index;
+      s.first_line = d->view.last_first_line;
+      s.diff_version = d->diff_version;
+    }
+    s.completions = code_completions_editor;
+    s.terminal_bytes = terminal_bytes;
+    s.box = box;
+    const PaneState &l = last_state;
+    int ret = damage;
+    if (s.top != l.top || s.version != l.version || s.cursor_x != l.cursor_x || s.cursor_y != l.cursor_y ||
+        s.first_line != l.first_line || s.diff_version != l.diff_version) ret |= DamageSource;
+    if (s.terminal_bytes != l.terminal_bytes) ret |= DamageTerminal;
+    if (s.completions != l.completions) ret |= DamageSource | DamageOverlay;
+    if (console_animating || (root->console && root->console->active)) ret |= DamageAll;
+    if (s.box.w != l.box.w || s.box.h != l.box.h || bottom_divider.changed || right_divider.changed ||
+        bottom_divider.changing || right_divider.changing) ret |= DamageAll;
+    last_state = s;
+    damage = 0;
+    return ret;
+  }
+
+  // SettingsFile::Save reads the flags as it writes them, and flags are only set here,
+  // so it runs here too, after the frame and only once a saved flag changed.
+  void SaveSettings() {
+    if (settings_saving || !Singleton<FlagMap>::Get()->dirty) return;
+    settings_saving = true;
+    app->RunInMainThread([=](){
+      settings_saving = false;
+      if (Singleton<FlagMap>::Get()->dirty) SettingsFile::Save(&app->localfs, app, app->save_settings);
+    });
+  }
+
   int Frame(LFL::Window *W, unsigned clicks, int flag) {
-    if (Singleton<FlagMap>::Get()->dirty) SettingsFile::Save(&app->localfs, app, app->save_settings);
+    TRACE_SPAN("Frame");
+    if (!started) {
+      started = true;
+      app->startup.Mark("first_frame");
+      INFO("startup: ", app->startup.StatsString());
+    }
+    SaveSettings();
     Time now = Now();
     MyEditorDialog *d = Top();
     GraphicsContext gc(W->gd);
+    if (d != selected_tab) { selected_tab = d; if (d) SelectedTab(d); }
     if (d && d->view.modified != Time(0) && d->view.modified + Seconds(1) <= now) {
       d->view.modified = Time(0); 
-      if (FLAGS_clang) ReparseTranslationUnit(FindOrDie(opened_files, d->view.file->Filename())); 
+      if (FLAGS_clang && !d->large_file) ReparseTranslationUnit(FindOrDie(opened_files, d->view.file->Filename())); 
+    }
+    if (d && d->regex_highlighter && d->highlight.Pending(LastVisibleLine(d))) {
+      UpdateHighlighting(d, chrono::milliseconds(FLAGS_highlight_slice_ms));
+      if (d->highlight.Pending(LastVisibleLine(d))) W->Wakeup();
+    }
+    if (d && d->large_file && d->visible_first >= 0) SlideWindow(d);
+    if (d && d->diff_base && !d->diffing && d->diff_version != d->buffer.version) UpdateDiffMarks(d);
+    if (d && d == code_completions_editor && completion_filter) UpdateCompletionFilter(d);
+    if (dir_tree_changed) {
+      dir_tree_changed = false;
+      dir_tree.view.Reload();
+      dir_tree.view.Redraw();
+      Damage(DamageRightPane);
+    }
+    {
+      TRACE_SPAN("TerminalWrite");
+      size_t budget = size_t(max(1, FLAGS_build_output_frame_kb)) << 10;
+      string output;
+      for (auto &j : jobs.job) {
+        output.clear();
+        if (j->output.Read(&output, budget)) W->Wakeup();
+        if (output.empty()) continue;
+        budget -= output.size();
+        JobTerminal(j.get())->Write(output);
+        if (j->id == shown_job) terminal_bytes += output.size();
+      }
     }
 
+    int damaged = TakeDamage(d);
+    if (!damaged && FLAGS_frame_skip) {
+      frame_stats.skipped++;
+      return -1;
+    }
+    // The back buffer is cleared every frame, so a frame that draws anything draws every
+    // pane.  Damage only decides whether the frame is drawn at all.
     gc.gd->DisableBlend();
     if (bottom_divider.changed || right_divider.changed) Layout();
     if (child_box.data.empty()) Layout();
     source_tabs.Draw();
+    if (d && d->diff_marks.size()) DrawDiffGutter(&gc, d);
     View::Draw();
     gc.gd->DrawMode(DrawMode::_2D);
-    if (bottom_center_pane.h) build_terminal->Draw(bottom_center_pane, TextArea::DrawFlag::CheckResized);
+    if (bottom_center_pane.h) ShownTerminal()->Draw(bottom_center_pane, TextArea::DrawFlag::CheckResized);
     gc.gd->DrawMode(DrawMode::_2D);
     if (right_pane.w) right_pane_tabs->Draw();
     if (right_divider.changing) BoxOutline().Draw(&gc, Box::DelBorder(right_pane, Border(1,1,1,1)));
     if (bottom_divider.changing) BoxOutline().Draw(&gc, Box::DelBorder(bottom_center_pane, Border(1,1,1,1)));
     if (code_completions_editor == d) code_completions.Draw();
     W->DrawDialogs();
+    frame_stats.Add(Now() - now, damaged);
     return 0;
   }
 
@@ -314,112 +1271,389 @@ struct EditorView : public View {
   void ParseTranslationUnit(shared_ptr<MyEditorDialog> d) {
     string filename = d->view.file->Filename(), compile_cmd, compile_dir;
     if (!app->project->GetCompileCommand(filename, &compile_cmd, &compile_dir)) {
-      if (!FileSuffix::CPP(filename)) return ERROR("no compile command for ", filename);
+      if (!FileSuffix::CPP(filename)) { tu_scheduler.Done(filename); return ERROR("no compile command for ", filename); }
       compile_cmd = "clang";
       compile_dir = default_project.output.substr(0, DirNameLen(default_project.output));
       for (auto &d : default_project.compile_definitions) StrAppend(&compile_cmd, " -D", d);
       for (auto &o : default_project.compile_options)     StrAppend(&compile_cmd, " ",   o);
       for (auto &i : default_project.include_directories) StrAppend(&compile_cmd, " -I", i);
-      StrAppend(&compile_cmd, "-c src.c -o out.o");
+      StrAppend(&compile_cmd, " -c src.c -o out.o");
     }
-    ParseTranslationUnit(d, new TranslationUnit(filename, compile_cmd, compile_dir), false);
+    ParseTranslationUnit(d, nullptr, false, compile_cmd, compile_dir);
   }
 
-  void ParseTranslationUnit(shared_ptr<MyEditorDialog> d, TranslationUnit *tu, bool reparse) {
+  void ParseTranslationUnit(shared_ptr<MyEditorDialog> d, TranslationUnit *tu, bool reparse,
+                            const string &compile_cmd=string(), const string &compile_dir=string()) {
+    string filename = d->view.file->Filename();
     d->reparsed++;
-    d->parsing = true;
-    d->needs_reparse = false;
     auto opened = MakeOpenedFilesVector();
-    for (auto i = d->view.file_line.Begin(); i.ind; ++i) i.val->next_tu_line = i.GetIndex();
-    app->RunInThreadPool([=](){
-      if (reparse) tu->Reparse(opened);
-      else         tu->Parse(opened);
-      if (FLAGS_clang_highlight)
-        ClangCPlusPlusHighlighter::UpdateAnnotation(tu, app->cpp_colors, d->view.default_attr, &d->next_annotation);
-      app->RunInMainThread([=](){ HandleParseTranslationUnitDone(d, tu, !reparse); });
+    int deltas = d->line_deltas.Position();
+    if (d->parse_deltas < 0) d->parse_deltas = deltas;
+    app->RunInThreadPool([=]() mutable {
+      auto files = MaterializeOpenedFiles(opened);
+      if (!tu) tu = new TranslationUnit
+        (filename, AddPrecompiledPreamble(filename, compile_cmd, compile_dir, files), compile_dir);
+      {
+        TRACE_SPAN(reparse ? "TranslationUnitReparse" : "TranslationUnitParse");
+        if (reparse) tu->Reparse(files);
+        else         tu->Parse(files);
+      }
+      auto annotation = make_shared<AnnotationStore>();
+      if (FLAGS_clang_highlight) {
+        TRACE_SPAN("ClangHighlight");
+        vector<DrawableAnnotation> lines;
+        ClangCPlusPlusHighlighter::UpdateAnnotation(tu, app->cpp_colors, d->view.default_attr, &lines);
+        annotation->Assign(lines);
+      }
+      app->RunInMainThread([=](){ HandleParseTranslationUnitDone(d, tu, !reparse, deltas, annotation); });
     });
   }
 
+  string AddPrecompiledPreamble(const string &filename, const string &compile_cmd, const string &compile_dir,
+                                const TranslationUnit::OpenedFiles &files) {
+    if (!preamble_cache) return compile_cmd;
+    for (auto &f : files)
+      if (f.first == filename) return preamble_cache->AddPrecompiledPreamble(compile_cmd, compile_dir, filename, f.second->buf);
+    return preamble_cache->AddPrecompiledPreamble(compile_cmd, compile_dir, filename, LocalFile::FileContents(filename));
+  }
+
+  // The TUs were made before their preamble was built, so both are replaced by ones
+  // using it, one per parse.
+  void HandlePreambleBuilt(const string &fn) {
+    if (!app->run) return;
+    auto it = opened_files.find(fn);
+    if (it == opened_files.end()) return;
+    it->second->fresh_tus = 2;
+    ReparseTranslationUnit(it->second);
+  }
+
+  // Selecting a tab rebuilds what eviction dropped, on demand, and may push the least
+  // recently selected background tabs out.
+  void SelectedTab(MyEditorDialog *d) {
+    string fn = d->view.file->Filename();
+    tab_budget.Touch(fn);
+    if (d->evicted) {
+      d->evicted = false;
+      tab_budget.restores++;
+      if (app->project && FLAGS_clang && d->file_type == FileType::CPP && !d->large_file) ReparseTranslationUnit(FindOrDie(opened_files, fn));
+      d->view.RefreshLines();
+      d->view.Redraw();
+      Damage(DamageSource);
+    }
+    EnforceMemoryBudget();
+  }
+
+  size_t TabBytes() const {
+    size_t ret = 0;
+    for (auto &f : opened_files) ret += f.second->Bytes();
+    return ret;
+  }
+
+  // Tabs with a parse queued or running keep their TUs, as do the selected tab and the
+  // tab named by keep, whose parse just landed.
+  void EnforceMemoryBudget(const string &keep=string()) {
+    if (!tab_budget.budget) return;
+    MyEditorDialog *top = Top();
+    vector<TabBudget::Tab> tabs;
+    for (auto &f : opened_files)
+      if (f.second.get() != top && f.first != keep && !tu_scheduler.Busy(f.first)) tabs.push_back(TabBudget::Tab{ f.first, f.second->EvictableBytes() });
+    auto victims = tab_budget.Victims(move(tabs), TabBytes());
+    for (auto &v : victims) {
+      FindOrDie(opened_files, v.filename)->Evict();
+      tab_budget.Evicted(v);
+    }
+    if (victims.size()) TabBudget::ReleaseFreeMemory();
+  }
+
   void ReparseTranslationUnit(shared_ptr<MyEditorDialog> d) {
-    if (d->parsing) { d->needs_reparse = true; return; }
-    if (d->next_tu && d->next_tu->parse_failed) d->next_tu.reset();
+    if (auto t = Top()) tu_scheduler.front = t->view.file->Filename();
+    tu_scheduler.Request(d->view.file->Filename());
+  }
+
+  void StartTranslationUnitParse(const string &fn) {
+    auto it = opened_files.find(fn);
+    if (it == opened_files.end()) { tu_scheduler.Done(fn); return; }
+    auto d = it->second;
+    bool fresh = d->fresh_tus > 0;
+    if (fresh) d->fresh_tus--;
+    if (d->next_tu && (fresh || d->next_tu->parse_failed || d->next_tu.use_count() > 1)) d->next_tu.reset();
     if (!d->next_tu) ParseTranslationUnit(d);
     else             ParseTranslationUnit(d, d->next_tu.get(), true);
   }
 
-  void HandleParseTranslationUnitDone(shared_ptr<MyEditorDialog> d, TranslationUnit *tu, bool replace) {
+  // Lines of the new TU are mapped to the buffer through line_deltas as they're used,
+  // so landing a parse doesn't visit every line, and only redraws if its annotations
+  // change what's on screen.
+  void HandleParseTranslationUnitDone(shared_ptr<MyEditorDialog> d, TranslationUnit *tu, bool replace,
+                                      int deltas, shared_ptr<AnnotationStore> annotation) {
     if (!app->run) return;
-    swap(d->main_tu, d->next_tu);
-    if (FLAGS_clang_highlight) swap(d->main_annotation, d->next_annotation);
-    if (replace) d->main_tu = unique_ptr<TranslationUnit>(tu);
-    for (auto i = d->view.file_line.Begin(); i.ind; ++i) {
-      if (i.val->next_tu_line >= 0) {
-        i.val->main_tu_line = i.val->next_tu_line;
-        if (FLAGS_clang_highlight) i.val->annotation_ind = i.val->main_tu_line;
-      }
-      i.val->next_tu_line =-1;
-    }
-    if (FLAGS_clang_highlight) {
-      d->view.RefreshLines();
-      d->view.Redraw();
+    TRACE_SPAN("TranslationUnitSwap");
+    string fn = d->view.file->Filename();
+    auto opened = opened_files.find(fn);
+    if (opened == opened_files.end() || opened->second != d) {
+      if (replace) delete tu;
+      tu_scheduler.Done(fn);
+      return;
     }
-    d->parsing = false;
+    swap(d->main_tu, d->next_tu);
+    d->completions.reset();
+    if (replace) d->main_tu = shared_ptr<TranslationUnit>(tu);
+    app->startup.Mark("first_parse");
+    bool cached = d->main_tu_deltas < 0 && d->cached_deltas >= 0;
+    vector<int> changed;
+    if (FLAGS_clang_highlight) changed = TUAnnotationChanged(d, *annotation, deltas, cached ? d->cached_annotation : d->tu_annotation,
+                                                             cached ? d->cached_deltas : d->main_tu_deltas);
+    d->cached_annotation = AnnotationStore();
+    d->cached_deltas = -1;
+    if (FLAGS_clang_highlight) swap(d->tu_annotation, *annotation);
+    d->main_tu_deltas = deltas;
+    d->parse_deltas = -1;
+    d->TrimLineDeltas();
+    if (changed.size()) RefreshLines(d.get(), move(changed));
+    tu_scheduler.Done(fn);
+    EnforceMemoryBudget(fn);
+  }
+
+  // The identifier being typed at the cursor: where it starts and what's typed so far.
+  void CompletionToken(MyEditorDialog *d, int *line, int *col, string *prefix) {
+    String16 text = d->GetSnapshot()->Line(d->view.cursor_line_index);
+    int x = min(int(text.size()), d->view.cursor.i.x), b = x;
+    while (b > 0 && IdentifierChar(text[b-1])) b--;
+    *line = d->view.cursor_line_index;
+    *col = b;
+    *prefix = String::ToUTF8(text.substr(b, x-b));
   }
 
+  // Completes at the start of the token, C++ on the thread pool and CMake on the daemon's
+  // thread.  Results are kept per file and token start, so typing on filters them instead
+  // of asking again.  The CMake daemon answers one at a time, so a request made while one
+  // is out waits for the next Tab, and a saved buffer isn't sent at all.
   void CompleteCode() {
     MyEditorDialog *d = Top();
     if (!d) return;
     if (d == code_completions_editor) return code_completions.deleted_cb();
+    if (!d->view.cursor_offset || d->large_file) return;
+    int line, col;
+    string prefix;
+    CompletionToken(d, &line, &col, &prefix);
+    if (d->completions && d->completions->line == line && d->completions->col == col) return ShowCompletions(d, prefix);
+    auto editor = FindOrDie(opened_files, d->view.file->Filename());
+    int request = ++d->completion_request;
     if (d->file_type == FileType::CPP) {
-      if (!d->view.cursor_offset || !d->main_tu) return;
-      code_completions.view.completions = d->main_tu->CompleteCode
-        (MakeOpenedFilesVector(), d->view.cursor_line_index, d->view.cursor.i.x);
+      if (!d->main_tu) return;
+      auto tu = d->main_tu;
+      auto opened = MakeOpenedFilesVector();
+      app->RunInThreadPool([=](){
+        auto set = make_shared<const CompletionSet>
+          (line, col, shared_ptr<CodeCompletions>(tu->CompleteCode(MaterializeOpenedFiles(opened), line, col)));
+        app->RunInMainThread(bind(&EditorView::HandleCompletions, this, editor, request, set));
+      });
     } else if (d->file_type == FileType::CMake) {
-      if (!d->view.cursor_offset || !cmakedaemon.Ready()) return;
-      d->view.CacheModifiedText(true);
-      code_completions.view.completions = cmakedaemon.CompleteCode
-        (d->view.file->Filename(), d->view.cursor_line_index, d->view.cursor.i.x, d->view.cached_text->buf);
-    } else return;
-    if (!code_completions.view.completions) return;
+      if (cmake_completing) return;
+      cmake_completing = true;
+      auto snap = d->GetSnapshot();
+      string fn = d->view.file->Filename();
+      int saved_version = d->saved_version;
+      Time start = Now();
+      cmake.Post([=](){
+        shared_ptr<CodeCompletions> results;
+        if (cmake.daemon.Ready())
+          results.reset(cmake.daemon.CompleteCode(fn, line, col, CMakeDaemonClient::DocumentText(snap, saved_version)));
+        auto set = make_shared<const CompletionSet>(line, col, move(results));
+        app->RunInMainThread([=](){
+          cmake_completing = false;
+          cmake.latency.Add("code_complete", Now() - start);
+          HandleCompletions(editor, request, set);
+        });
+      });
+    }
+  }
+
+  void HandleCompletions(shared_ptr<MyEditorDialog> d, int request, shared_ptr<const CompletionSet> set) {
+    if (request != d->completion_request || !set->source) return;
+    d->completions = set;
+    if (Top() != d.get()) return;
+    int line, col;
+    string prefix;
+    CompletionToken(d.get(), &line, &col, &prefix);
+    if (line != set->line || col != set->col) return;
+    ShowCompletions(d.get(), prefix);
+  }
+
+  void ShowCompletions(MyEditorDialog *d, const string &prefix) {
+    auto filtered = make_unique<FilteredCodeCompletions>(d->completions);
+    filtered->Filter(prefix);
+    if (!filtered->size()) return;
+    completion_filter = filtered.get();
+    code_completions.view.completions = move(filtered);
     code_completions.view.RefreshLines();
     code_completions.view.Redraw();
     point dim(d->view.style.font->max_width*20, d->view.style.font->Height()*10);
     code_completions.box = Box(d->view.cursor.p - point(0, dim.y), dim);
     code_completions_editor = d;
+    Damage(DamageOverlay);
+  }
+
+  void UpdateCompletionFilter(MyEditorDialog *d) {
+    int line, col;
+    string prefix;
+    CompletionToken(d, &line, &col, &prefix);
+    auto &set = completion_filter->set;
+    if (line != set->line || col != set->col) return code_completions.deleted_cb();
+    if (prefix == completion_filter->prefix) return;
+    completion_filter->Filter(prefix);
+    code_completions.view.RefreshLines();
+    code_completions.view.Redraw();
+    Damage(DamageOverlay);
   }
 
   void GotoMatchingBrace() {
     MyEditorDialog *d = Top();
-    if (!d || !d->main_tu || !d->view.cursor_offset || d->view.cursor_offset->main_tu_line < 0) return;
-    auto r = d->main_tu->GetCursorExtent(d->view.file->Filename(), d->view.cursor_offset->main_tu_line, d->view.cursor.i.x);
-    if (IsOpenParen(d->view.CursorGlyph())) d->view.ScrollTo(r.second.y-1, r.second.x-1);
-    else                                    d->view.ScrollTo(r.first .y-1, r.first .x-1);
+    int line = d ? d->MainTULine() : -1;
+    if (!d || !d->main_tu || d->main_tu.use_count() > 1 || !d->view.cursor_offset || line < 0) return;
+    auto r = d->main_tu->GetCursorExtent(d->view.file->Filename(), line, d->view.cursor.i.x);
+    auto &p = IsOpenParen(d->view.CursorGlyph()) ? r.second : r.first;
+    int y = d->line_deltas.ToCurrent(p.y-1, d->main_tu_deltas);
+    if (y >= 0) d->view.ScrollTo(y, p.x-1);
   }
 
   void GotoDefinition() {
     MyEditorDialog *d = Top();
-    if (!d || !d->main_tu || !d->view.cursor_offset || d->view.cursor_offset->main_tu_line < 0) return;
-    auto fo = d->main_tu->FindDefinition(d->view.file->Filename(), d->view.cursor_offset->main_tu_line, d->view.cursor.i.x);
+    if (!d || (d->locations.size() && GotoLocation(d)) || !d->view.cursor_offset) return;
+    int line = d->MainTULine();
+    bool tu_ready = d->main_tu && d->main_tu.use_count() == 1 && line >= 0;
+    if (!tu_ready && symbol_index) {
+      string name = IdentifierAtCursor(d);
+      if (name.size()) ShowLocations(symbol_index->FindDefinitions(name), StrCat(name, ".definitions"));
+      return;
+    }
+    if (!tu_ready) return;
+    auto fo = d->main_tu->FindDefinition(d->view.file->Filename(), line, d->view.cursor.i.x);
     if (fo.fn.empty()) return;
-    auto editor = Open(fo.fn);
-    editor->view.ScrollTo(fo.y-1, fo.x-1);
+    if (fo.fn == d->view.file->Filename()) {
+      fo.y = d->line_deltas.ToCurrent(fo.y-1, d->main_tu_deltas) + 1;
+      if (fo.y <= 0) return;
+    }
+    if (auto editor = Open(fo.fn)) ScrollToLine(editor, fo.y-1, fo.x-1);
+  }
+
+  void FindReferences() {
+    MyEditorDialog *d = Top();
+    if (!d || !symbol_index) return;
+    string name = IdentifierAtCursor(d);
+    if (name.size()) ShowLocations(symbol_index->FindReferences(name), StrCat(name, ".references"));
+  }
+
+  void GotoSymbol(const string &query) {
+    if (query.empty()) return gotosymbol_panel->Show();
+    if (symbol_index) ShowLocations(symbol_index->SearchSymbols(query, 200), StrCat(query, ".symbols"));
   }
 
   void GotoLine(const string &line) {
     if (line.empty()) gotoline_panel->Show();
-    else if (MyEditorDialog *d = Top()) d->view.ScrollTo(atoi(line)-1, 0);
+    else if (MyEditorDialog *d = Top()) ScrollToLine(d, atoll(line.c_str())-1, 0);
   }
 
+  // Searches a snapshot, or the mapping of a large file, on the thread pool and streams
+  // results back in batches.
   void Find(const string &line) {
     MyEditorDialog *d = Top();
     if (line.empty() || !d) return find_panel->Show();
-    CHECK(d->view.CacheModifiedText(true));
+    if (d->find_cancel) *d->find_cancel = true;
+    auto cancel = make_shared<atomic<bool>>(false);
+    auto editor = FindOrDie(opened_files, d->view.file->Filename());
+    auto snap = d->large_file ? nullptr : d->GetSnapshot();
+    auto index = d->large_file;
+    if (index && !index->file.Intact()) { ERROR(index->file.filename, " changed on disk, reopen it"); return; }
+    d->find_cancel = cancel;
     d->find_results.clear();
-    Regex regex(line);
-    RegexLineMatcher(&regex, d->view.cached_text->buf).MatchAll(&d->find_results);
-    if (!d->find_results.size()) return find_panel->SetTitle("Find");
     d->find_results_ind = -1;
-    FindPrevOrNext(false);
+    find_panel->SetTitle("Find [searching]");
+    app->RunInThreadPool([=](){
+      bool literal = false;
+      string required = TextSearch::RequiredLiteral(line, &literal);
+      auto matcher = TextSearch::MakeLineMatcher(literal ? required : line, literal);
+      const char *b = index ? index->file.data : snap->File()->buf.data();
+      const char *e = index ? b + index->file.size : b + snap->File()->buf.size();
+      vector<pair<int, int>> batch;
+      Time flushed = Now();
+      auto flush = [&](bool done) {
+        app->RunInMainThread(bind(&EditorView::HandleFindResults, this, editor, cancel, move(batch), done));
+        batch.clear();
+        flushed = Now();
+      };
+      TextSearch::Search(b, e, required, matcher, cancel.get(),
+                         [&](int l, int c, const char*, const char*) {
+                           batch.emplace_back(l, c);
+                           if (batch.size() >= 4096 || Now() - flushed > chrono::milliseconds(50)) flush(false);
+                         });
+      flush(true);
+    });
+  }
+
+  void HandleFindResults(shared_ptr<MyEditorDialog> d, shared_ptr<atomic<bool>> cancel,
+                         const vector<pair<int, int>> &results, bool done) {
+    if (*cancel || d->find_cancel != cancel) return;
+    bool first = d->find_results.empty();
+    d->find_results.insert(d->find_results.end(), results.begin(), results.end());
+    if (done) d->find_cancel.reset();
+    if (Top() != d.get()) return;
+    if (first && d->find_results.size()) return FindPrevOrNext(false);
+    if (d->find_results.empty()) return find_panel->SetTitle(done ? "Find" : "Find [searching]");
+    find_panel->SetTitle(StrCat("Find [", d->find_results_ind+1, " of ", d->find_results.size(), done ? "" : "+", "]"));
+  }
+
+  // Background scans take at most this many pool workers, always leaving one free, so
+  // queued parses, completions and saves don't wait behind a whole tree's worth of work.
+  static int ScanWorkers() { return max(1, min(FLAGS_scan_workers, FLAGS_threadpool_size - 1)); }
+
+  // Splits the source tree, as the project explorer shows it, across ScanWorkers() pool
+  // workers.  Each file is searched with the same prefiltered scan as Find, and the
+  // results open in a tab that Go To Definition follows.
+  void FindInFiles(const string &pattern) {
+    if (pattern.empty() || !app->project) return findinfiles_panel->Show();
+    if (findinfiles_cancel) *findinfiles_cancel = true;
+    auto cancel = findinfiles_cancel = make_shared<atomic<bool>>(false);
+    string source_dir = app->project->source_dir, build_dir = app->project->build_dir;
+    int jobs = ScanWorkers();
+    long long max_size = (long long)(max(0, FLAGS_find_in_files_max_kb)) << 10;
+    findinfiles_panel->SetTitle("Find in Files [searching]");
+    app->RunInThreadPool([=](){
+      auto files = make_shared<vector<string>>();
+      IgnoreRules ignore;
+      ignore.AddPrefix(build_dir);
+      DirectoryWalker(move(ignore)).Walk(source_dir, [&](const string &fn, long long size)
+                                         { if (size <= max_size) files->push_back(fn); });
+      auto results = make_shared<vector<string>>(files->size());
+      auto locations = make_shared<vector<vector<MappedSymbolIndex::Location>>>(files->size());
+      auto remaining = make_shared<atomic<int>>(jobs);
+      for (int job = 0; job < jobs; job++) app->RunInThreadPool([=](){
+        bool literal = false;
+        string required = TextSearch::RequiredLiteral(pattern, &literal);
+        auto matcher = TextSearch::MakeLineMatcher(literal ? required : pattern, literal);
+        for (size_t i = job; i < files->size() && !*cancel; i += jobs) {
+          ifstream in((*files)[i], ios::binary);
+          string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>()), &out = (*results)[i];
+          if (TextSearch::IsBinary(text)) continue;
+          TextSearch::Search(text.data(), text.data() + text.size(), required, matcher, cancel.get(),
+                             [&](int l, int c, const char *b, const char *e) {
+                               StrAppend(&out, (*files)[i], ":", l+1, ":", c+1, ": ", string(b, e), "\n");
+                               (*locations)[i].push_back({ (*files)[i], "", "", l+1, c+1, 0 });
+                             });
+        }
+        if (--*remaining) return;
+        string text;
+        vector<MappedSymbolIndex::Location> loc;
+        for (auto &r : *results) text.append(r);
+        for (auto &l : *locations) loc.insert(loc.end(), l.begin(), l.end());
+        app->RunInMainThread([=](){
+          if (*cancel || findinfiles_cancel != cancel) return;
+          findinfiles_cancel.reset();
+          findinfiles_panel->SetTitle("Find in Files");
+          if (text.size()) OpenLocations(text, StrCat(pattern, ".find"), loc);
+        });
+      });
+    });
   }
 
   void FindPrevOrNext(bool prev) {
@@ -427,47 +1661,215 @@ struct EditorView : public View {
     if (!d || !d->find_results.size()) return;
     d->find_results_ind = RingIndex::Wrap(d->find_results_ind + (prev ? -1 : 1), d->find_results.size());
     const auto &r = d->find_results[d->find_results_ind];
-    d->view.ScrollTo(r.first, r.second);
+    ScrollToLine(d, r.first, r.second);
     find_panel->SetTitle(StrCat("Find [", d->find_results_ind+1, " of ", d->find_results.size(), "]"));
   }
 
-  void Build() {
-    if (bottom_divider.size < root->default_font->Height()) ShowBuildTerminal();
-    if (build_process.in) return;
-    vector<const char*> argv{ app->build_bin.c_str(), nullptr };
-    string build_dir = StrCat(app->project->build_dir, LocalFileSystem::Slash, "term");
-    CHECK(!build_process.Open(&argv[0], build_dir.c_str()));
-    app->RunInNetworkThread([=](){ app->net->unix_client->AddConnectedSocket
-      (fileno(build_process.in), make_unique<Connection::CallbackHandler>
-       ([=](Connection *c){ build_terminal->Write(c->rb.buf); c->ReadFlush(c->rb.size()); },
-        [=](Connection *c){ build_process.Close(); })); });
+  // Builds everything, or one target from the targets tree, with make's own -j.  A build
+  // takes every job slot, so builds run one at a time and alone.
+  void Build(const string &target=string()) {
+    if (!app->project) return;
+    string name = target.empty() ? "build" : StrCat("build ", target);
+    if (jobs.Busy(name)) return;
+    vector<string> argv{ app->build_bin, StrCat("-j", jobs.workers) };
+    if (target.size()) argv.push_back(target);
+    AddJob(name, StrCat(app->project->build_dir, LocalFileSystem::Slash, "term"), move(argv), jobs.workers);
   }
 
   void Tidy() {
     MyEditorDialog *d = Top();
+    if (!app->project || !d) return;
+    string src_file = d->view.file->Filename(), name = StrCat("tidy ", src_file);
+    if (jobs.Busy(name)) return;
+    AddJob(name, app->project->build_dir, TidyCommand(src_file));
+  }
+
+  // One clang-tidy job per file in the compile database.
+  void TidyProject() {
+    if (!app->project) return;
+    string build_dir = app->project->build_dir;
+    const IDEProject *project = app->project.get();
+    app->RunInThreadPool([=](){
+      auto sources = make_shared<vector<string>>(SymbolIndex::GetSources(*project, false));
+      app->RunInMainThread([=](){
+        INFO("tidy: ", sources->size(), " files");
+        for (auto &fn : *sources) if (!jobs.Busy(StrCat("tidy ", fn))) AddJob(StrCat("tidy ", fn), build_dir, TidyCommand(fn));
+        root->Wakeup();
+      });
+    });
+  }
+
+  vector<string> TidyCommand(const string &fn) {
+    return vector<string>{ StrCat(FLAGS_llvm_dir, "/bin/clang-tidy"), "-p", app->project->build_dir, fn };
+  }
+
+  void AddJob(string name, string dir, vector<string> argv, int slots=1) {
     if (bottom_divider.size < root->default_font->Height()) ShowBuildTerminal();
-    if (build_process.in || !d) return;
-    string tidy_bin = StrCat(FLAGS_llvm_dir, "/bin/clang-tidy"), src_file = d->view.file->Filename(),
-           build_dir = app->project->build_dir;
-    vector<const char*> argv{ tidy_bin.c_str(), "-p", build_dir.c_str(), src_file.c_str(), nullptr };
-    CHECK(!build_process.Open(&argv[0], build_dir.c_str()));
+    jobs.StartBatch();
+    auto j = jobs.Add(move(name), move(dir), move(argv), size_t(max(1, FLAGS_build_output_buffer_kb)) << 10, slots);
+    if (!jobs.Find(shown_job)) ShowJob(j->id);
+  }
+
+  // Output goes through the job's BuildOutput, which Frame drains into its terminal.
+  bool StartJob(const shared_ptr<JobScheduler::Job> &job) {
+    vector<const char*> argv;
+    for (auto &a : job->argv) argv.push_back(a.c_str());
+    argv.push_back(nullptr);
+    job->process = make_unique<JobProcess>();
+    if (job->process->Open(&argv[0], job->dir.c_str())) { ERROR("job ", job->name, " failed to start"); return false; }
+    job->output.Reset(job->dir);
     app->RunInNetworkThread([=](){ app->net->unix_client->AddConnectedSocket
-      (fileno(build_process.in), make_unique<Connection::CallbackHandler>
-       ([=](Connection *c){ build_terminal->Write(c->rb.buf); c->ReadFlush(c->rb.size()); },
-        [=](Connection *c){ build_process.Close(); })); });
+      (fileno(job->process->in), make_unique<Connection::CallbackHandler>
+       ([=](Connection *c){
+         TRACE_SPAN("TerminalIngest");
+         if (job->output.Write(c->rb.begin(), c->rb.size())) app->RunInMainThread([=](){ root->Wakeup(); });
+         c->ReadFlush(c->rb.size());
+       },
+       [=](Connection *c){
+         int status = job->process->Close();
+         job->output.Finish();
+         app->RunInMainThread([=](){ HandleJobDone(job, status); });
+       })); });
+    return true;
+  }
+
+  void HandleJobDone(shared_ptr<JobScheduler::Job> job, int status) {
+    jobs.Done(job.get(), status);
+    INFO(job->name, job->cancelled ? " cancelled" : (status ? " failed" : " finished"), " in ",
+         chrono::duration_cast<chrono::milliseconds>(job->Wall()).count(), " ms: ", job->output.StatsString(),
+         " [", jobs.ProgressString(), "]");
+    root->Wakeup();
+  }
+
+  Terminal *JobTerminal(JobScheduler::Job *j) {
+    if (!j->terminal) {
+      j->terminal = make_unique<Terminal>(nullptr, root, root->default_font);
+      j->terminal->newline_mode = true;
+    }
+    return j->terminal.get();
+  }
+
+  Terminal *ShownTerminal() {
+    auto j = jobs.Find(shown_job);
+    return j ? JobTerminal(j) : build_terminal.get();
+  }
+
+  void ShowJob(int id) {
+    shown_job = id;
+    Damage(DamageTerminal);
+    if (auto j = jobs.Find(id)) INFO("showing job ", id, ": ", j->name);
+  }
+
+  void ShowNextJob() {
+    if (jobs.job.empty()) return;
+    auto i = find_if(jobs.job.begin(), jobs.job.end(), [=](const shared_ptr<JobScheduler::Job> &j){ return j->id == shown_job; });
+    ShowJob((i == jobs.job.end() || ++i == jobs.job.end() ? jobs.job.front() : *i)->id);
+  }
+
+  void GotoBuildDiagnostic(bool prev) {
+    BuildOutput::Diagnostic diag;
+    int index, total;
+    auto j = jobs.Find(shown_job);
+    if (!j || !j->output.Step(prev, &diag, &index, &total)) return;
+    INFO(diag.error ? "error " : "warning ", index+1, " of ", total, ": ", diag.fn, ":", diag.line, ":", diag.col, ": ", diag.message);
+    if (auto editor = Open(diag.fn)) ScrollToLine(editor, diag.line-1, diag.col-1);
+  }
+
+  void SetDiffBase(MyEditorDialog *d, shared_ptr<const vector<LineDiff::Hash>> base, bool saved) {
+    d->diff_base = move(base);
+    d->diff_base_saved = saved;
+    d->diff_version = -1;
+  }
+
+  // Rediffs the buffer against the gutter base on the thread pool.  Once the whole
+  // buffer has been hashed, only the lines edited since are rehashed, here, before the
+  // diff goes out.  Frame calls this again once the result lands if the buffer moved on.
+  void UpdateDiffMarks(MyEditorDialog *d) {
+    auto editor = FindOrDie(opened_files, d->view.file->Filename());
+    auto snap = d->GetSnapshot();
+    auto base = d->diff_base;
+    bool incremental = d->line_hashes.valid && int(d->line_hashes.hash.size()) == snap->lines;
+    shared_ptr<const vector<LineDiff::Hash>> current;
+    if (incremental) {
+      d->line_hashes.Rehash([&](int y){ return String::ToUTF8(snap->Line(y)); });
+      current = make_shared<const vector<LineDiff::Hash>>(d->line_hashes.Hashes());
+    }
+    d->diffing = true;
+    app->RunInThreadPool([=](){
+      auto hashes = current;
+      if (!hashes) {
+        const string &text = snap->File()->buf;
+        hashes = make_shared<const vector<LineDiff::Hash>>(LineDiff::HashLines(text.data(), text.data() + text.size()));
+      }
+      auto marks = LineDiff::Marks(LineDiff::Diff(*base, *hashes), hashes->size());
+      app->RunInMainThread([=](){
+        editor->diffing = false;
+        if (!current && editor->buffer.version == snap->version) editor->line_hashes.Reset(*hashes, snap->lines);
+        if (editor->diff_base != base) return;
+        editor->diff_marks = marks;
+        editor->diff_version = snap->version;
+      });
+    });
+  }
+
+  void DrawDiffGutter(GraphicsContext *gc, MyEditorDialog *d) {
+    Editor *e = &d->view;
+    int fh = e->style.font->Height(), top = source_tabs.box.top() - source_tabs.tab_dim.y, row = 0;
+    for (auto &l : VisibleLines(d)) {
+      int line = l.first, rows = l.second;
+      if (line >= int(d->diff_marks.size())) break;
+      char mark = d->diff_marks[line];
+      row += rows;
+      if (mark == LineDiff::Unchanged) continue;
+      gc->gd->SetColor(mark == LineDiff::Added ? Color::green : (mark == LineDiff::Modified ? Color::blue : Color::red));
+      BoxFilled().Draw(gc, Box(source_tabs.box.x, top - row * fh, 3, mark == LineDiff::Deleted ? 2 : rows * fh));
+    }
+    gc->gd->SetColor(Color::white);
+  }
+
+  // Diffs the buffer against base_cb() on the thread pool, opens the unified diff in a
+  // tab, and makes base the gutter base.
+  void DiffBuffer(MyEditorDialog *d, function<bool(string*)> base_cb, const string &base_name, bool saved) {
+    if (!d || d->large_file) return;
+    auto editor = FindOrDie(opened_files, d->view.file->Filename());
+    auto snap = d->GetSnapshot();
+    string fn = d->view.file->Filename();
+    app->RunInThreadPool([=](){
+      string base_text;
+      if (!base_cb(&base_text)) return;
+      string diff = LineDiff::Unified(base_text, snap->File()->buf, base_name, fn);
+      auto base = make_shared<const vector<LineDiff::Hash>>
+        (LineDiff::HashLines(base_text.data(), base_text.data() + base_text.size()));
+      app->RunInMainThread([=](){
+        SetDiffBase(editor.get(), base, saved);
+        if (diff.empty()) INFO(fn, ": no changes against ", base_name);
+        else OpenFile(make_unique<BufferFile>(diff, StrCat(fn, ".diff").c_str()));
+      });
+    });
   }
 
   void DiffUnsavedChanges() {
     MyEditorDialog *d = Top();
     if (!d) return;
-    BufferFile current(string(""));
-    d->view.SaveTo(&current);
-    diff_match_patch<string> dmp;
-    OpenFile(make_unique<BufferFile>(dmp.patch_toText(dmp.patch_make(d->view.file->Contents(), current.buf)),
-                                     StrCat(d->view.file->Filename(), ".diff").c_str()));
+    string saved = d->view.file->Contents();
+    DiffBuffer(d, [=](string *out){ *out = saved; return true; }, d->view.file->Filename(), true);
   }
 
   void DiffCVS() {
+    MyEditorDialog *d = Top();
+    if (!d) return;
+    string fn = d->view.file->Filename(), cvs = FLAGS_cvs_cmd;
+    size_t slash = fn.rfind('/');
+    string dir = slash == string::npos ? "." : fn.substr(0, slash), rev = StrCat("HEAD:./", fn.substr(slash + 1));
+    DiffBuffer(d, [=](string *out){
+      vector<const char*> argv{ cvs.c_str(), "show", rev.c_str(), nullptr };
+      ProcessPipe process;
+      if (process.Open(&argv[0], dir.c_str())) { ERROR(cvs, " show ", rev, " failed"); return false; }
+      char buf[4096];
+      for (size_t l; (l = fread(buf, 1, sizeof(buf), process.in)); ) out->append(buf, l);
+      if (process.Close()) { ERROR(cvs, " show ", rev, " failed"); return false; }
+      return true;
+    }, rev, false);
   }
 };
 
@@ -484,8 +1886,63 @@ void MyApp::OnWindowStart(Window *W) {
   W->frame_cb = bind(&EditorView::Frame, editor_gui, _1, _2, _3);
   W->default_textbox = [=](){ auto t = editor_gui->Top(); return t ? &t->view : nullptr; };
   W->shell = make_unique<Shell>(W);
+  W->AddInputController(make_unique<EditorView::DamageInput>(editor_gui));
   BindMap *binds = W->AddInputController(make_unique<BindMap>());
   binds->Add('6', Key::Modifier::Cmd, Bind::CB(bind(&Shell::console, W->shell.get(), vector<string>())));
+  W->shell->command.emplace_back("tu_stats", [=](const vector<string>&) { INFO("tu_stats: ", editor_gui->tu_scheduler.StatsString()); });
+  W->shell->command.emplace_back("build_stats", [=](const vector<string>&) {
+    auto j = editor_gui->jobs.Find(editor_gui->shown_job);
+    INFO("build_stats: ", j ? j->output.StatsString() : "no job");
+  });
+  W->shell->command.emplace_back("jobs", [=](const vector<string> &arg) {
+    auto j = arg.size() > 1 ? editor_gui->jobs.Find(atoi(arg[1].c_str())) : nullptr;
+    if      (arg.size() && arg[0] == "cancel") { if (j) editor_gui->jobs.Cancel(j); else editor_gui->jobs.CancelAll(); }
+    else if (arg.size() && arg[0] == "show" && j) editor_gui->ShowJob(j->id);
+    INFO("jobs: ", editor_gui->jobs.StatsString(), editor_gui->jobs.ListString());
+  });
+  W->shell->command.emplace_back("frame_stats", [=](const vector<string> &arg) {
+    static const char *panes[] = { "source", "terminal", "right_pane", "overlay" };
+    if (arg.size() && arg[0] == "reset") return editor_gui->frame_stats.Reset();
+    INFO("frame_stats: ", editor_gui->frame_stats.HistogramString(panes));
+  });
+  W->shell->command.emplace_back("trace", [=](const vector<string> &arg) {
+    if (arg.size() && (arg[0] == "on" || arg[0] == "off")) Trace::Enabled() = arg[0] == "on";
+    else if (arg.size() && arg[0] == "clear") Trace::Clear();
+    INFO("trace: ", Trace::Enabled() ? "on" : "off", " events=", Trace::Events());
+  });
+  W->shell->command.emplace_back("trace_save", [=](const vector<string> &arg) {
+    string fn = arg.size() ? arg[0] : "tepidfusion-trace.json";
+    bool enabled = Trace::Enabled().exchange(false);
+    ofstream out(fn);
+    if (!(out << Trace::ChromeJSON())) ERROR("trace_save: write ", fn, " failed");
+    else INFO("trace_save: wrote ", Trace::Events(), " events to ", fn);
+    Trace::Enabled() = enabled;
+  });
+  W->shell->command.emplace_back("mem_stats", [=](const vector<string>&) {
+    string tabs;
+    for (auto &f : editor_gui->opened_files)
+      StrAppend(&tabs, "\n", f.second->Bytes() >> 10, "kb undo=", f.second->UndoBytes() >> 10, "kb",
+                f.second->evicted ? " evicted " : " ", f.first);
+    INFO("mem_stats: ", editor_gui->tab_budget.StatsString(editor_gui->TabBytes()), tabs);
+  });
+  W->shell->command.emplace_back("undo_stats", [=](const vector<string>&) {
+    string tabs;
+    for (auto &f : editor_gui->opened_files)
+      if (f.second->undo) StrAppend(&tabs, "\n", f.second->undo->StatsString(), " ", f.first);
+    INFO("undo_stats:", tabs);
+  });
+  W->shell->command.emplace_back("startup_stats", [=](const vector<string>&) { INFO("startup_stats: ", app->startup.StatsString()); });
+  W->shell->command.emplace_back("journal_stats", [=](const vector<string>&) {
+    INFO("journal_stats: ", editor_gui->journal ? editor_gui->journal->StatsString() : "disabled");
+  });
+  W->shell->command.emplace_back("dir_stats", [=](const vector<string>&) {
+    INFO("dir_stats: listed=", editor_gui->dir_node.size(), " listing=", editor_gui->dir_listing.size(), " watches=",
+         editor_gui->dir_watcher ? editor_gui->dir_watcher->Watches() : 0);
+  });
+  W->shell->command.emplace_back("cmake_stats", [=](const vector<string>&) { INFO("cmake_stats:\n", editor_gui->cmake.latency.StatsString()); });
+  W->shell->command.emplace_back("preamble_stats", [=](const vector<string>&) {
+    INFO("preamble_stats: ", editor_gui->preamble_cache ? editor_gui->preamble_cache->StatsString() : "disabled");
+  });
 }
 
 }; // namespace LFL
@@ -493,12 +1950,16 @@ using namespace LFL;
 
 extern "C" LFApp *MyAppCreate(int argc, const char* const* argv) {
   FLAGS_enable_video = FLAGS_enable_input = true;
-  FLAGS_threadpool_size = 1;
+  FLAGS_threadpool_size = 0;
   app = make_unique<MyApp>(argc, argv).release();
   app->focused = app->framework->ConstructWindow(app).release();
   app->name = "TepidFusion";
   app->window_start_cb = bind(&MyApp::OnWindowStart, app, _1);
   app->window_init_cb = bind(&MyApp::OnWindowInit, app, _1);
+  app->window_closed_cb = [closed_cb = app->window_closed_cb](Window *W) {
+    if (auto editor_view = W->GetOwnView<EditorView>(0)) editor_view->SaveSession();
+    if (closed_cb) closed_cb(W);
+  };
   app->window_init_cb(app->focused);
   return app;
 }
@@ -506,12 +1967,18 @@ extern "C" LFApp *MyAppCreate(int argc, const char* const* argv) {
 extern "C" int MyAppMain(LFApp *application) {
   if (app->Create(__FILE__)) return -1;
   SettingsFile::Load(&app->localfs, app);
+  if (FLAGS_parse_workers <= 0) FLAGS_parse_workers = max(1, int(thread::hardware_concurrency()) / 2);
+  FLAGS_threadpool_size = max(FLAGS_threadpool_size, FLAGS_parse_workers + 1);
+  if (FLAGS_scan_workers <= 0) FLAGS_scan_workers = max(1, FLAGS_threadpool_size / 2);
+  if (FLAGS_build_jobs <= 0) FLAGS_build_jobs = max(1, int(thread::hardware_concurrency()));
   app->focused->gl_w = FLAGS_width;
   app->focused->gl_h = FLAGS_height;
 
   if (app->Init()) return -1;
+  app->startup.Mark("init");
+  Trace::Enabled() = FLAGS_trace;
   int optind = Singleton<FlagMap>::Get()->optind;
-  if (optind >= app->argc) { fprintf(stderr, "Usage: %s [-flags] <file>\n", app->argv[0]); return -1; }
+  if (optind >= app->argc && FLAGS_project.empty()) { fprintf(stderr, "Usage: %s [-flags] <file>\n", app->argv[0]); return -1; }
 
   app->scheduler.AddMainWaitKeyboard(app->focused);
   app->scheduler.AddMainWaitMouse(app->focused);
@@ -520,6 +1987,7 @@ extern "C" int MyAppMain(LFApp *application) {
   if (start_network_thread) {
     app->net = make_unique<SocketServices>(app, app);
     CHECK(app->CreateNetworkThread(false, true));
+    app->startup.Mark("network");
   }
   
   if (FLAGS_project.size()) {
@@ -532,7 +2000,10 @@ extern "C" int MyAppMain(LFApp *application) {
   app->StartNewWindow(app->focused);
   app->focused->gd->ClearColor(Color::grey70);
   EditorView *editor_view = app->focused->GetOwnView<EditorView>(0);
+  app->startup.Mark("window");
 
-  editor_view->Open(app->argv[optind]);
+  editor_view->RestoreSession();
+  if (optind < app->argc) editor_view->Open(app->argv[optind]);
+  app->startup.Mark("open");
   return app->Main();
 }
@@ -0,0 +1,74 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_FRAME_STATS_H__
+#define LFL_EDITOR_FRAME_STATS_H__
+namespace LFL {
+
+// Frame times bucketed by powers of two milliseconds, ie <1, <2, <4 ... <256, >=256.
+struct FrameStats {
+  static const int buckets = 10, panes = 4;
+  long long histogram[buckets], pane_damage[panes], drawn=0, skipped=0;
+  Time total=Time(0), longest=Time(0);
+  FrameStats() { Reset(); }
+
+  void Reset() {
+    fill(histogram, histogram + buckets, 0);
+    fill(pane_damage, pane_damage + panes, 0);
+    drawn = skipped = 0;
+    total = longest = Time(0);
+  }
+
+  static int Bucket(Time t) {
+    long long ms = chrono::duration_cast<chrono::milliseconds>(t).count();
+    int b = 0;
+    for (long long limit = 1; b < buckets - 1 && ms >= limit; limit *= 2) b++;
+    return b;
+  }
+
+  void Add(Time t, int damage) {
+    drawn++;
+    histogram[Bucket(t)]++;
+    total += t;
+    longest = max(longest, t);
+    for (int i = 0; i < panes; i++) if (damage & (1 << i)) pane_damage[i]++;
+  }
+
+  // The bucket holding the p'th percentile frame, as its upper bound in ms.
+  int Percentile(double p) const {
+    long long seen = 0, target = (long long)(ceil(drawn * p));
+    for (int b = 0; b < buckets; b++) if ((seen += histogram[b]) >= target && seen) return 1 << b;
+    return 0;
+  }
+
+  string HistogramString(const char* const* pane_names) const {
+    auto us = [](Time t){ return chrono::duration_cast<chrono::microseconds>(t).count(); };
+    string ret = StrCat("drawn=", drawn, " skipped=", skipped, " avg_us=", drawn ? us(total) / drawn : 0,
+                        " max_us=", us(longest), " p50<", Percentile(.5), "ms p99<", Percentile(.99), "ms\n");
+    for (int b = 0; b < buckets; b++) {
+      if (!histogram[b]) continue;
+      StrAppend(&ret, b == buckets - 1 ? ">=" : "<", b == buckets - 1 ? 1 << (b - 1) : 1 << b, "ms ",
+                histogram[b], " ", string(drawn ? 40 * histogram[b] / drawn : 0, '#'), "\n");
+    }
+    for (int i = 0; i < panes; i++) StrAppend(&ret, i ? " " : "", pane_names[i], "=", pane_damage[i]);
+    return ret;
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_FRAME_STATS_H__
@@ -0,0 +1,99 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_HIGHLIGHT_H__
+#define LFL_EDITOR_HIGHLIGHT_H__
+namespace LFL {
+
+// Lexer state (the SyntaxMatcher anchor) saved at the start of every interval'th line.
+// Lines are lexed from the top only as far as the view has shown, the frontier, and
+// after an edit the catch-up pass stops at the first checkpoint whose state comes out
+// unchanged.  A frontier of -1 means the whole file has been lexed.
+struct HighlightCheckpoints {
+  struct Checkpoint { int line, anchor; };
+  int interval, dirty_line=-1, scan_line=-1, scan_anchor=0, frontier=0, frontier_anchor=0;
+  vector<Checkpoint> checkpoint;
+  HighlightCheckpoints(int I=256) : interval(max(1, I)) {}
+
+  // Whether lexing is due with the view showing lines up to last.
+  bool Pending(int last) const { return dirty_line >= 0 || (frontier >= 0 && frontier <= last); }
+  void Clear() { checkpoint.clear(); dirty_line = scan_line = -1; frontier = frontier_anchor = 0; }
+
+  Checkpoint Seek(int line) const {
+    auto i = upper_bound(checkpoint.begin(), checkpoint.end(), line,
+                         [](int l, const Checkpoint &c){ return l < c.line; });
+    return i == checkpoint.begin() ? Checkpoint{ 0, 0 } : *(i - 1);
+  }
+
+  // Where the catch-up pass starts when it isn't resuming: the checkpoint before the
+  // first edited line, else the frontier.
+  void Start() {
+    if (scan_line >= 0) return;
+    Checkpoint cp = dirty_line >= 0 ? Seek(dirty_line) : Checkpoint{ frontier, frontier_anchor };
+    scan_line = cp.line;
+    scan_anchor = cp.anchor;
+  }
+
+  // Called by the catch-up pass before lexing scan_line.  Returns false to stop, either
+  // because the state matches what was saved before the edit, so everything down to the
+  // frontier is still valid, or because the pass is past last and the frontier.
+  bool Continue(int last) {
+    if (frontier >= 0 && scan_line >= frontier) {
+      dirty_line = -1;
+      frontier = scan_line;
+      frontier_anchor = scan_anchor;
+      if (scan_line > last) return false;
+    }
+    if (!Update(scan_line, scan_anchor)) return true;
+    dirty_line = scan_line = -1;
+    return false;
+  }
+
+  bool Update(int line, int anchor) {
+    auto i = lower_bound(checkpoint.begin(), checkpoint.end(), line,
+                         [](const Checkpoint &c, int l){ return c.line < l; });
+    if (i != checkpoint.end() && i->line == line) {
+      bool converged = i->anchor == anchor && dirty_line >= 0 && line > dirty_line;
+      i->anchor = anchor;
+      return converged;
+    }
+    if (line % interval == 0) checkpoint.insert(i, Checkpoint{ line, anchor });
+    return false;
+  }
+
+  // The pass reached the end of the file.
+  void Done() { dirty_line = scan_line = frontier = -1; }
+
+  // Edits past the frontier need no lexing until the view gets there.  One that reaches
+  // it pulls the frontier back to its last inserted line.
+  void Modify(int line, int lines_inserted, int lines_erased) {
+    scan_line = -1;
+    if (frontier >= 0 && line >= frontier) return;
+    auto b = upper_bound(checkpoint.begin(), checkpoint.end(), line,
+                         [](int l, const Checkpoint &c){ return l < c.line; });
+    auto e = upper_bound(b, checkpoint.end(), line + lines_erased,
+                         [](int l, const Checkpoint &c){ return l < c.line; });
+    b = checkpoint.erase(b, e);
+    for (int delta = lines_inserted - lines_erased; b != checkpoint.end(); ++b) b->line += delta;
+    if (frontier >= 0) frontier = line + lines_erased >= frontier ? line + lines_inserted : frontier + lines_inserted - lines_erased;
+    dirty_line = dirty_line < 0 ? line : min(dirty_line, line);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_HIGHLIGHT_H__
@@ -0,0 +1,221 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_JOB_SCHEDULER_H__
+#define LFL_EDITOR_JOB_SCHEDULER_H__
+#ifndef LFL_WINDOWS
+#include <signal.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+namespace LFL {
+
+// A job's process, with its stdout and stderr read from in.  Outside Windows it leads a
+// process group of its own, so a signal reaches everything it started, ie make's compilers,
+// and it inherits no other descriptor, so it can't hold the journal's lock, the daemon's
+// socket or another job's pipe open past the editor.
+struct JobProcess {
+  FILE *in=0;
+#ifdef LFL_WINDOWS
+  ProcessPipe pipe;
+  int Open(const char* const* argv, const char *dir) { int ret = pipe.Open(argv, dir); in = pipe.in; return ret; }
+  int Close() { return pipe.Close(); }
+  void Signal(int) {}
+#else
+  atomic<int> pid{0};
+
+  int Open(const char* const* argv, const char *dir) {
+    int fd[2], max_fd = sysconf(_SC_OPEN_MAX);
+#ifdef __linux__
+    if (pipe2(fd, O_CLOEXEC)) { ERROR("pipe2: ", strerror(errno)); return -1; }
+#else
+    if (pipe(fd)) { ERROR("pipe: ", strerror(errno)); return -1; }
+    fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+#endif
+    int child = fork();
+    if (!child) {
+      setpgid(0, 0);
+      dup2(fd[1], 1);
+      dup2(fd[1], 2);
+      CloseFrom(3, max_fd);
+      if (dir && chdir(dir)) _exit(127);
+      execvp(argv[0], const_cast<char* const*>(argv));
+      _exit(127);
+    }
+    close(fd[1]);
+    if (child < 0) { ERROR("fork: ", strerror(errno)); close(fd[0]); return -1; }
+    setpgid(child, child);
+    pid = child;
+    in = fdopen(fd[0], "r");
+    return 0;
+  }
+
+  // Closes every descriptor from first on, in the forked child, so only async-signal-safe
+  // calls are made.
+  static void CloseFrom(int first, int max_fd) {
+#if defined(__linux__) && defined(SYS_close_range)
+    if (!syscall(SYS_close_range, first, ~0U, 0)) return;
+#elif defined(__FreeBSD__) || defined(__OpenBSD__)
+    return closefrom(first);
+#endif
+    for (int i = first; i < max_fd; i++) close(i);
+  }
+
+  int Close() {
+    if (in) { fclose(in); in = 0; }
+    int status = 0, p = pid.exchange(0);
+    if (p > 0) while (waitpid(p, &status, 0) < 0 && errno == EINTR) {}
+    return status;
+  }
+
+  void Signal(int sig) { if (int p = pid) kill(-p, sig); }
+#endif
+};
+
+// Main-thread bookkeeping for build and tidy processes.  Queued jobs start in order
+// while their slots fit in workers, a job taking one slot or, like a build running
+// make's own -j, all of them, so builds never overlap.  Each job's output goes to a
+// BuildOutput and terminal of its own.  Finished jobs are kept, with their output,
+// until the next batch.
+struct JobScheduler {
+  enum { Queued=0, Running=1, Finished=2 };
+  struct Job {
+    int id, slots, state=Queued, status=0;
+    bool cancelled=0;
+    string name, dir;
+    vector<string> argv;
+    BuildOutput output;
+    unique_ptr<JobProcess> process;
+    unique_ptr<Terminal> terminal;
+    Time queued, started=Time(0), finished=Time(0);
+    Job(int I, string N, string D, vector<string> A, size_t output_capacity, int S=1) :
+      id(I), slots(S), name(move(N)), dir(move(D)), argv(move(A)), output(output_capacity), queued(Now()) {}
+    Time Wall() const { return state == Queued ? Time(0) : (state == Finished ? finished : Now()) - started; }
+  };
+  struct Stats {
+    long long started=0, completed=0, failed=0, cancelled=0;
+    Time wall_total=Time(0), wall_max=Time(0);
+  };
+
+  int workers, next_id=1;
+  vector<shared_ptr<Job>> job;
+  function<bool(const shared_ptr<Job>&)> start_cb;
+  function<void(Job*)> cancel_cb;
+  Stats stats;
+  JobScheduler(int W=1) : workers(max(1, W)) {}
+
+  int Count(int state) const { return count_if(job.begin(), job.end(), [=](const shared_ptr<Job> &j){ return j->state == state; }); }
+  bool Idle() const { return !Count(Queued) && !Count(Running); }
+
+  int RunningSlots() const {
+    int ret = 0;
+    for (auto &j : job) if (j->state == Running) ret += j->slots;
+    return ret;
+  }
+
+  Job *Find(int id) const {
+    for (auto &j : job) if (j->id == id) return j.get();
+    return nullptr;
+  }
+
+  bool Busy(const string &name) const {
+    for (auto &j : job) if (j->name == name && j->state != Finished) return true;
+    return false;
+  }
+
+  // Starts a new batch if nothing is queued or running, forgetting the finished jobs.
+  void StartBatch() { if (Idle()) job.clear(); }
+
+  Job *Add(string name, string dir, vector<string> argv, size_t output_capacity, int slots=1) {
+    job.push_back(make_shared<Job>(next_id++, move(name), move(dir), move(argv), output_capacity, min(workers, max(1, slots))));
+    Job *ret = job.back().get();
+    Dispatch();
+    return ret;
+  }
+
+  // A job that doesn't fit holds back the jobs queued after it, so a build isn't starved.
+  void Dispatch() {
+    for (auto i = job.begin(), e = job.end(); i != e; ++i) {
+      auto j = *i;
+      if (j->state != Queued) continue;
+      int used = RunningSlots();
+      if (used && used + j->slots > workers) break;
+      j->state = Running;
+      j->started = Now();
+      stats.started++;
+      if (!start_cb(j)) Done(j.get(), -1);
+    }
+  }
+
+  void Done(Job *j, int status) {
+    if (j->state == Finished) return;
+    j->state = Finished;
+    j->status = status;
+    j->finished = Now();
+    Time wall = j->Wall();
+    stats.completed++;
+    if (j->cancelled) stats.cancelled++;
+    else if (status) stats.failed++;
+    stats.wall_total += wall;
+    stats.wall_max = max(stats.wall_max, wall);
+    Dispatch();
+  }
+
+  // Queued jobs finish at once.  Running ones are signalled, and finish when they exit.
+  void Cancel(Job *j) {
+    if (j->state == Finished || j->cancelled) return;
+    j->cancelled = true;
+    if (j->state == Queued) { j->state = Running; j->started = Now(); Done(j, -1); }
+    else cancel_cb(j);
+  }
+
+  void CancelAll() {
+    for (auto i = job.rbegin(), e = job.rend(); i != e; ++i) Cancel(i->get());
+  }
+
+  string ProgressString() const {
+    int failed = count_if(job.begin(), job.end(), [](const shared_ptr<Job> &j){ return j->state == Finished && j->status; });
+    return StrCat(Count(Finished), "/", job.size(), " done, ", Count(Running), " running, ", failed, " failed");
+  }
+
+  string ListString() const {
+    static const char *state[] = { "queued", "running", "finished" };
+    string ret;
+    for (auto &j : job) {
+      auto counts = j->output.Counts();
+      StrAppend(&ret, "\n", j->id, " ", j->cancelled ? "cancelled" : state[j->state],
+                j->state == Finished ? StrCat(" status=", j->status) : "",
+                " ms=", chrono::duration_cast<chrono::milliseconds>(j->Wall()).count(),
+                " errors=", counts.first, " warnings=", counts.second, " ", j->name);
+    }
+    return ret;
+  }
+
+  string StatsString() const {
+    auto ms = [](Time t){ return chrono::duration_cast<chrono::milliseconds>(t).count(); };
+    return StrCat("workers=", workers, " ", ProgressString(), " started=", stats.started, " completed=", stats.completed,
+                  " failed=", stats.failed, " cancelled=", stats.cancelled, " max_ms=", ms(stats.wall_max),
+                  " avg_ms=", stats.completed ? ms(stats.wall_total) / stats.completed : 0);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_JOB_SCHEDULER_H__
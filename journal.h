@@ -0,0 +1,252 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_JOURNAL_H__
+#define LFL_EDITOR_JOURNAL_H__
+#ifndef LFL_WINDOWS
+#include <sys/file.h>
+#endif
+namespace LFL {
+
+// Writes a file by writing and syncing a temp file beside it and renaming it over the
+// target, so a reader or a crash sees the old contents or the new, never part of both.
+// Each write has a temp file of its own, and the rename is synced with the directory.
+struct AtomicFile {
+  static bool Write(const string &fn, const string &text) {
+#ifdef LFL_WINDOWS
+    string dir = fn.substr(0, DirNameLen(fn));
+    char tmp[MAX_PATH];
+    if (!GetTempFileNameA(dir.size() ? dir.c_str() : ".", "tf", 0, tmp)) { ERROR("GetTempFileName ", fn); return false; }
+    {
+      ofstream out(tmp, ios::binary);
+      if (!(out << text)) { DeleteFileA(tmp); return false; }
+    }
+    if (MoveFileExA(tmp, fn.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) return true;
+    DeleteFileA(tmp);
+    return false;
+#else
+    char real[PATH_MAX];
+    string target = realpath(fn.c_str(), real) ? string(real) : fn, tmp = StrCat(target, ".XXXXXX");
+    string dir = target.substr(0, DirNameLen(target));
+    struct stat s;
+    int fd = mkstemp(&tmp[0]);
+    if (fd < 0) { ERROR("mkstemp ", tmp, ": ", strerror(errno)); return false; }
+    bool ok = !fchmod(fd, stat(target.c_str(), &s) ? 0644 : (s.st_mode & 07777));
+    for (size_t wrote = 0; ok && wrote < text.size(); ) {
+      ssize_t n = write(fd, text.data() + wrote, text.size() - wrote);
+      if (n > 0) wrote += n;
+      else ok = n < 0 && errno == EINTR;
+    }
+    if (ok && fsync(fd)) ok = false;
+    if (close(fd)) ok = false;
+    if (ok && !rename(tmp.c_str(), target.c_str())) {
+      if ((fd = open(dir.size() ? dir.c_str() : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+        if (fsync(fd)) ERROR("fsync ", dir, ": ", strerror(errno));
+        close(fd);
+      }
+      return true;
+    }
+    ERROR("write ", target, ": ", strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+#endif
+  }
+};
+
+// An exclusive lock on a file, held while this lives, so a second process can tell the
+// file it guards is in use.  Always taken where there's no flock().
+struct LockFile {
+  int fd=-1;
+  bool locked=0;
+  LockFile(const string &fn) {
+#ifdef LFL_WINDOWS
+    locked = true;
+#else
+    if ((fd = open(fn.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) { ERROR("open ", fn, ": ", strerror(errno)); return; }
+    locked = !flock(fd, LOCK_EX | LOCK_NB);
+#endif
+  }
+  virtual ~LockFile() { if (fd >= 0) close(fd); }
+};
+
+// Append-only log of buffer edits, for restoring unsaved buffers after a crash.  Each
+// record is a header line, the filename, then the payload and a newline, so a record torn
+// by a crash ends the replay.  A file's records follow its base: the text it was loaded
+// or saved with, identified by hash, or a recovered text carried in the record.  Closing a
+// file's tab ends its records, discarding any unsaved edits.  Records are batched and
+// synced by a thread of its own.  Compact() swaps the whole journal for a shorter one
+// that recovers the same buffers.
+struct EditJournal {
+  enum { Base='B', Edit='E', Saved='S', Recovered='R', Closed='C' };
+  typedef unsigned long long Hash;
+  struct Stats { long long records=0, bytes=0, syncs=0, compactions=0; };
+  struct Recovery { string filename; Hash base; string text; };
+  string filename;
+  FILE *file=0;
+  int batch_ms;
+  mutex lock;
+  condition_variable cv;
+  string queued;
+  bool done=0, rewrite=0;
+  long long size=0;
+  Stats stats;
+  thread worker;
+
+  EditJournal(const string &fn, int ms=200) : filename(fn), batch_ms(ms) {
+    if (!(file = fopen(filename.c_str(), "ab"))) { ERROR("open ", filename, ": ", strerror(errno)); return; }
+    if (!fseek(file, 0, SEEK_END)) size = ftell(file);
+    worker = thread(bind(&EditJournal::Run, this));
+  }
+
+  virtual ~EditJournal() {
+    if (!file) return;
+    { ScopedMutex l(lock); done = true; }
+    cv.notify_one();
+    worker.join();
+    fclose(file);
+  }
+
+  static Hash HashText(const string &text) {
+    Hash h = 14695981039346656037ULL;
+    for (unsigned char c : text) h = (h ^ c) * 1099511628211ULL;
+    return h;
+  }
+
+  static string Record(char type, const string &fn, int version, Hash a, int b=0, int c=0, const string &payload=string()) {
+    return StrCat(string(1, type), " ", fn.size(), " ", version, " ", a, " ", b, " ", c, " ", payload.size(), "\n", fn, payload, "\n");
+  }
+
+  void Append(string record) {
+    if (!file) return;
+    {
+      ScopedMutex l(lock);
+      queued.append(record);
+      size += record.size();
+      stats.records++;
+    }
+    cv.notify_one();
+  }
+
+  // Replaces the journal, and any records still queued, with records standing for all of
+  // them, ie a base or recovered text per open buffer.
+  void Compact(string records) {
+    if (!file) return;
+    {
+      ScopedMutex l(lock);
+      queued = move(records);
+      size = queued.size();
+      rewrite = true;
+      stats.compactions++;
+    }
+    cv.notify_one();
+  }
+
+  long long Size() { ScopedMutex l(lock); return size; }
+
+  void AddBase     (const string &fn, int version, Hash h) { Append(Record(Base,  fn, version, h)); }
+  void AddSaved    (const string &fn, int version, Hash h) { Append(Record(Saved, fn, version, h)); }
+  void AddEdit     (const string &fn, int version, int y, int x, bool erase, const string &text) { Append(Record(Edit, fn, version, y, x, erase, text)); }
+  void AddRecovered(const string &fn, int version, Hash h, const string &text) { Append(Record(Recovered, fn, version, h, 0, 0, text)); }
+  void AddClosed   (const string &fn) { Append(Record(Closed, fn, 0, 0)); }
+
+  void Run() {
+    for (;;) {
+      string write;
+      bool replace;
+      {
+        unique_lock<mutex> l(lock);
+        cv.wait(l, [&](){ return done || rewrite || queued.size(); });
+        if (!done) cv.wait_for(l, chrono::milliseconds(batch_ms), [&](){ return done; });
+        swap(write, queued);
+        replace = rewrite;
+        rewrite = false;
+        stats.bytes += write.size();
+        if (write.size()) stats.syncs++;
+      }
+      // A journal that can't be replaced takes the records appended instead, which
+      // recover the same buffers, as each starts its file's records over.
+      if (replace && AtomicFile::Write(filename, write)) {
+        if (FILE *f = fopen(filename.c_str(), "ab")) { fclose(file); file = f; }
+        else ERROR("open ", filename, ": ", strerror(errno));
+        continue;
+      }
+      if (write.size() && (fwrite(write.data(), 1, write.size(), file) != write.size() || fflush(file)))
+        ERROR("write ", filename, ": ", strerror(errno));
+#ifndef LFL_WINDOWS
+      if (write.size()) fdatasync(fileno(file));
+#endif
+      if (done) { ScopedMutex l(lock); if (queued.empty() && !rewrite) return; }
+    }
+  }
+
+  string StatsString() {
+    ScopedMutex l(lock);
+    return StrCat("records=", stats.records, " bytes=", stats.bytes, " syncs=", stats.syncs,
+                  " compactions=", stats.compactions, " size=", size);
+  }
+
+  // Replays a journal against the files on disk, returning the text of each buffer that
+  // differs from its file.  Files changed on disk since their base are skipped.
+  static vector<Recovery> Recover(const string &journal_fn) {
+    struct Change { int version, y, x, erase; string text; };
+    struct File { Hash base=0; bool has_text=0; string text; vector<Change> change; };
+    map<string, File> files;
+    ifstream in(journal_fn, ios::binary);
+    for (string header; getline(in, header); ) {
+      char type;
+      int version, b, c;
+      size_t fn_len, len;
+      Hash a;
+      if (sscanf(header.c_str(), "%c %zu %d %llu %d %d %zu", &type, &fn_len, &version, &a, &b, &c, &len) != 7) break;
+      string fn(fn_len, 0), payload(len, 0);
+      if (!in.read(&fn[0], fn_len) || (len && !in.read(&payload[0], len)) || in.get() != '\n') break;
+      if (type == Closed) { files.erase(fn); continue; }
+      File &f = files[fn];
+      switch (type) {
+        case Base:      f = File();  f.base = a;  break;
+        case Recovered: f = File();  f.base = a;  f.has_text = true;  f.text = move(payload);  break;
+        case Edit:      f.change.push_back(Change{ version, int(a), b, c, move(payload) });  break;
+        case Saved:
+          f.base = a;
+          f.has_text = false;
+          f.change.erase(f.change.begin(), find_if(f.change.begin(), f.change.end(), [=](const Change &x){ return x.version > version; }));
+          break;
+      }
+    }
+
+    vector<Recovery> ret;
+    for (auto &i : files) {
+      File &f = i.second;
+      if (!f.has_text && f.change.empty()) continue;
+      string disk = LocalFile::FileContents(i.first);
+      if (HashText(disk) != f.base) { ERROR("journal: ", i.first, " changed on disk, not recovering"); continue; }
+      PieceTable buffer;
+      buffer.Load(String::ToUTF16(f.has_text ? f.text : disk));
+      for (auto &c : f.change) {
+        if (c.erase) buffer.Erase(c.y, c.x, String::ToUTF16(c.text).size());
+        else         buffer.Insert(c.y, c.x, String::ToUTF16(c.text));
+      }
+      string text = buffer.GetSnapshot()->File()->buf;
+      if (text != disk) ret.push_back(Recovery{ i.first, f.base, move(text) });
+    }
+    return ret;
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_JOURNAL_H__
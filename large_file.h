@@ -0,0 +1,152 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_LARGE_FILE_H__
+#define LFL_EDITOR_LARGE_FILE_H__
+namespace LFL {
+
+// A private read-only mapping.  Reading past the end of a file truncated under the
+// mapping faults, so callers check Intact() before touching the data.
+struct MappedFile {
+  string filename;
+  const char *data=0;
+  size_t size=0;
+#ifdef LFL_WINDOWS
+  string buf;
+#else
+  int fd=-1;
+  time_t mtime=0;
+#endif
+  MappedFile(const string &fn) : filename(fn) {}
+  ~MappedFile() {
+#ifndef LFL_WINDOWS
+    if (data && size) munmap(const_cast<char*>(data), size);
+    if (fd >= 0) close(fd);
+#endif
+  }
+
+  bool Open() {
+#ifdef LFL_WINDOWS
+    ifstream in(filename, ios::binary);
+    if (!in) return false;
+    buf.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    data = buf.data();
+    size = buf.size();
+#else
+    struct stat s;
+    if ((fd = open(filename.c_str(), O_RDONLY)) < 0 || fstat(fd, &s)) return false;
+    mtime = s.st_mtime;
+    if (!(size = s.st_size)) return true;
+    void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) { size = 0; return false; }
+    madvise(p, size, MADV_RANDOM);
+    data = static_cast<const char*>(p);
+#endif
+    return true;
+  }
+
+  // False once the file was truncated or rewritten since it was mapped.
+  bool Intact() const {
+#ifdef LFL_WINDOWS
+    return true;
+#else
+    struct stat s;
+    return fd >= 0 && !fstat(fd, &s) && size_t(s.st_size) == size && s.st_mtime == mtime;
+#endif
+  }
+};
+
+// Newline index over a mapped file.  Per-chunk newline counts are taken in parallel
+// when the file opens; the offsets of the newlines in a chunk are only recorded once
+// a line in that chunk is asked for.  Lines are 0-based and line n starts right after
+// the n'th newline.
+struct LargeFileIndex {
+  static const size_t chunk_size = 16 << 20;
+  MappedFile file;
+  vector<long long> chunk_newlines, chunk_first_newline;
+  vector<unique_ptr<vector<unsigned>>> chunk_offsets;
+  long long newlines=0;
+  bool counted=0;
+  LargeFileIndex(const string &fn) : file(fn) {}
+
+  bool Open() {
+    if (!file.Open()) return false;
+    size_t chunks = max(size_t(1), (file.size + chunk_size - 1) / chunk_size);
+    chunk_newlines.resize(chunks);
+    chunk_offsets.resize(chunks);
+    return true;
+  }
+
+  int Chunks() const { return chunk_newlines.size(); }
+  const char *ChunkBegin(int c) const { return file.data + c * chunk_size; }
+  const char *ChunkEnd(int c) const { return file.data + min(file.size, (c + 1) * chunk_size); }
+  long long Lines() const { return newlines + 1; }
+
+  // Thread-safe for distinct chunks.
+  void CountChunk(int c) { chunk_newlines[c] = TextSearch::CountNewlines(ChunkBegin(c), ChunkEnd(c)); }
+
+  void FinishCount() {
+    chunk_first_newline.resize(chunk_newlines.size());
+    newlines = 0;
+    for (size_t c = 0; c < chunk_newlines.size(); c++) {
+      chunk_first_newline[c] = newlines;
+      newlines += chunk_newlines[c];
+    }
+    counted = true;
+  }
+
+  const vector<unsigned> &ChunkOffsets(int c) {
+    auto &o = chunk_offsets[c];
+    if (o) return *o;
+    o = make_unique<vector<unsigned>>();
+    o->reserve(chunk_newlines[c]);
+    for (const char *b = ChunkBegin(c), *p = b, *e = ChunkEnd(c); (p = static_cast<const char*>(memchr(p, '\n', e - p))); p++)
+      o->push_back(p - b);
+    return *o;
+  }
+
+  size_t LineOffset(long long line) {
+    if (line <= 0) return 0;
+    if (line > newlines) return file.size;
+    int c = upper_bound(chunk_first_newline.begin(), chunk_first_newline.end(), line - 1) - chunk_first_newline.begin() - 1;
+    while (c > 0 && !chunk_newlines[c]) c--;
+    return c * chunk_size + ChunkOffsets(c)[line - 1 - chunk_first_newline[c]] + 1;
+  }
+
+  // Before the count finishes only the head of the file can be materialized.
+  long long FindLineInHead(long long lines, size_t *offset) const {
+    const char *p = file.data, *e = file.data + file.size;
+    long long n = 0;
+    for (; n < lines && p < e && (p = static_cast<const char*>(memchr(p, '\n', e - p))); n++) p++;
+    *offset = p ? p - file.data : file.size;
+    return n;
+  }
+
+  string Slice(long long first, long long count) {
+    if (!counted) {
+      size_t end;
+      FindLineInHead(count, &end);
+      return string(file.data, end);
+    }
+    size_t b = LineOffset(first), e = LineOffset(first + count);
+    return string(file.data + b, e - b);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_LARGE_FILE_H__
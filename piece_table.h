@@ -0,0 +1,161 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_PIECE_TABLE_H__
+#define LFL_EDITOR_PIECE_TABLE_H__
+namespace LFL {
+
+// Text lives in immutable chunks: the original file plus append-only add chunks.  A
+// Snapshot copies only the piece list, so handing the unsaved text to a worker is
+// O(pieces) on the main thread and the UTF-8 copy happens once, on whoever needs it.
+// Pieces may split a surrogate pair, so the text is joined before it's converted.
+struct PieceTable {
+  struct Chunk {
+    unique_ptr<char16_t[]> data;
+    int size=0, capacity=0;
+    vector<int> newline;
+    Chunk(int cap, int max_newlines) : data(new char16_t[cap]), capacity(cap) { newline.reserve(max_newlines); }
+    int Available() const { return capacity - size; }
+    int Append(const char16_t *s, int len) {
+      int offset = size;
+      for (int i = 0; i != len; ++i) if ((data[size + i] = s[i]) == '\n') newline.push_back(size + i);
+      size += len;
+      return offset;
+    }
+    int FirstNewline(int b) const { return lower_bound(newline.begin(), newline.end(), b) - newline.begin(); }
+  };
+
+  // Pieces remember where their newlines start in the chunk's index, so readers on
+  // other threads never look at the size of a chunk that's still being appended to.
+
+  struct Piece {
+    shared_ptr<const Chunk> chunk;
+    int offset, len, first_newline, newlines;
+    Piece(shared_ptr<const Chunk> c, int o, int l) : chunk(move(c)), offset(o), len(l),
+      first_newline(chunk->FirstNewline(o)), newlines(chunk->FirstNewline(o+l) - first_newline) {}
+    int FindNewline(int n) const { return chunk->newline.data()[first_newline + n] - offset; }
+    const char16_t *begin() const { return &chunk->data[offset]; }
+    const char16_t *end() const { return &chunk->data[offset + len]; }
+  };
+
+  struct Snapshot {
+    int version, size, lines;
+    vector<Piece> piece;
+    mutable once_flag materialized;
+    mutable shared_ptr<BufferFile> file;
+    Snapshot(int v, int s, int l, vector<Piece> p) : version(v), size(s), lines(l), piece(move(p)) {}
+
+    const shared_ptr<BufferFile> &File() const {
+      call_once(materialized, [&](){
+        String16 text;
+        text.reserve(size);
+        for (auto &p : piece) text.append(p.begin(), p.end());
+        file = make_shared<BufferFile>(String::ToUTF8(text));
+      });
+      return file;
+    }
+
+    String16 Line(int y) const {
+      String16 ret;
+      auto p = piece.begin();
+      int b = 0;
+      for (; p != piece.end() && y; ++p) {
+        if (y > p->newlines) { y -= p->newlines; continue; }
+        b = p->FindNewline(y-1) + 1;
+        break;
+      }
+      for (; p != piece.end(); ++p, b = 0) {
+        const char16_t *s = p->begin() + b, *e = find(s, p->end(), '\n');
+        ret.append(s, e);
+        if (e != p->end()) break;
+      }
+      return ret;
+    }
+  };
+
+  static const int chunk_size = 64*1024;
+  vector<Piece> piece;
+  shared_ptr<Chunk> add;
+  int version=0, size=0, lines=1;
+  bool loaded=0;
+
+  void Load(const String16 &text) {
+    auto original = make_shared<Chunk>(max(1, int(text.size())), count(text.begin(), text.end(), '\n'));
+    original->Append(text.data(), text.size());
+    piece.clear();
+    if (text.size()) piece.emplace_back(move(original), 0, text.size());
+    add.reset();
+    size = text.size();
+    lines = 1 + (piece.size() ? piece[0].newlines : 0);
+    loaded = true;
+    version++;
+  }
+
+  shared_ptr<const Snapshot> GetSnapshot() const { return make_shared<Snapshot>(version, size, lines, piece); }
+
+  int Offset(int y, int x) const {
+    int offset = 0;
+    if (y) for (auto &p : piece) {
+      if (y > p.newlines) { y -= p.newlines; offset += p.len; continue; }
+      offset += p.FindNewline(y-1) + 1;
+      break;
+    }
+    return min(size, offset + x);
+  }
+
+  void Insert(int y, int x, const String16 &text) {
+    if (text.empty()) return;
+    int offset = Offset(y, x), len = text.size(), piece_ind = Split(offset);
+    if (!add || add->Available() < len) { int cap = len > chunk_size ? len : chunk_size; add = make_shared<Chunk>(cap, cap); }
+    int add_offset = add->Append(text.data(), len);
+    Piece *prev = piece_ind ? &piece[piece_ind-1] : nullptr;
+    if (prev && prev->chunk == add && prev->offset + prev->len == add_offset) {
+      prev->len += len;
+      prev->newlines = add->FirstNewline(prev->offset + prev->len) - prev->first_newline;
+    } else piece.emplace(piece.begin() + piece_ind, add, add_offset, len);
+    lines += count(text.begin(), text.end(), '\n');
+    size += len;
+    version++;
+  }
+
+  void Erase(int y, int x, int len) {
+    int offset = Offset(y, x);
+    if ((len = min(len, size - offset)) <= 0) return;
+    int b = Split(offset), e = Split(offset + len);
+    for (auto i = piece.begin() + b, end = piece.begin() + e; i != end; ++i) lines -= i->newlines;
+    piece.erase(piece.begin() + b, piece.begin() + e);
+    size -= len;
+    version++;
+  }
+
+  int Split(int offset) {
+    int ind = 0;
+    for (auto i = piece.begin(); i != piece.end(); ++i, ++ind) {
+      if (offset == 0) return ind;
+      if (offset >= i->len) { offset -= i->len; continue; }
+      Piece tail(i->chunk, i->offset + offset, i->len - offset);
+      *i = Piece(i->chunk, i->offset, offset);
+      piece.insert(i + 1, move(tail));
+      return ind + 1;
+    }
+    return ind;
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_PIECE_TABLE_H__
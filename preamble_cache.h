@@ -0,0 +1,356 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_PREAMBLE_CACHE_H__
+#define LFL_EDITOR_PREAMBLE_CACHE_H__
+namespace LFL {
+
+inline unsigned long long FNV64(const char *s, size_t len, unsigned long long h=14695981039346656037ULL) {
+  for (const char *e = s + len; s != e; ++s) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  return h;
+}
+
+inline string HexFNV64(unsigned long long h) { char buf[17]; snprintf(buf, sizeof(buf), "%016llx", h); return buf; }
+
+// Content-addressed precompiled preambles, shared by every file whose leading block of
+// includes and compile flags hash the same.  Each <key>.pch has a <key>.deps manifest
+// listing the headers it was built from, with their sizes, mtimes and content hashes;
+// a lookup rehashes only the headers whose size or mtime changed.  PCHs are built
+// without timestamps, so clang itself doesn't reject one for a header that was only
+// touched.  Missing PCHs are built in the background with run_cb, and built_cb is
+// called for each file that asked for one while it was building.  The file's own
+// #includes are parsed again after the PCH, so one is used only if every header in it
+// is guarded against a second inclusion.
+struct PreambleCache {
+  typedef function<void(function<void()>)> RunCB;
+  typedef function<void(const string&)> BuiltCB;
+  struct Header { string fn; long long size=0, mtime=0; unsigned long long hash=0; bool guarded=0; };
+  string dir, clang_bin;
+  RunCB run_cb;
+  BuiltCB built_cb;
+  mutable mutex lock;
+  unordered_map<string, vector<string>> building;
+  atomic<long long> hits{0}, misses{0}, failures{0}, unguarded{0};
+  PreambleCache(const string &D, const string &C, RunCB R, BuiltCB B) :
+    dir(D), clang_bin(C), run_cb(move(R)), built_cb(move(B)) {}
+
+  static bool StatFile(const string &fn, long long *size, long long *mtime) {
+    struct stat s;
+    if (stat(fn.c_str(), &s)) return false;
+    *size = s.st_size;
+    *mtime = s.st_mtime;
+    return true;
+  }
+
+  static bool HashFile(const string &fn, unsigned long long *out) {
+    ifstream in(fn, ios::binary);
+    if (!in) return false;
+    char buf[65536];
+    unsigned long long h = FNV64("", 0);
+    while (in.read(buf, sizeof(buf)) || in.gcount()) h = FNV64(buf, in.gcount(), h);
+    *out = h;
+    return true;
+  }
+
+  // The leading run of blank lines, comments and preprocessor directives, cut back to
+  // the last point where every #if is closed.
+  static string GetPreamble(const string &text) {
+    size_t end = 0, line_end;
+    int depth = 0;
+    bool in_comment = false;
+    for (size_t i = 0; i < text.size(); i = line_end + 1) {
+      if ((line_end = text.find('\n', i)) == string::npos) line_end = text.size();
+      size_t b = text.find_first_not_of(" \t\r", i);
+      if (b == string::npos || b >= line_end) { if (!depth && !in_comment) end = line_end; continue; }
+      if (in_comment || text.compare(b, 2, "/*") == 0) {
+        size_t close = text.find("*/", in_comment ? b : b + 2);
+        in_comment = close == string::npos || close >= line_end;
+        if (!in_comment && text.find_first_not_of(" \t\r", close + 2) < line_end) break;
+      } else if (text.compare(b, 2, "//") == 0) {
+      } else if (text[b] == '#') {
+        size_t d = min(text.size(), text.find_first_not_of(" \t", b + 1));
+        if      (text.compare(d, 2, "if") == 0) depth++;
+        else if (text.compare(d, 5, "endif") == 0) depth--;
+        if (line_end > 0 && text[line_end-1] == '\\') break;
+      } else break;
+      if (!depth && !in_comment) end = line_end;
+    }
+    return text.substr(0, end);
+  }
+
+  // The text with comments and string literals blanked, newlines kept.
+  static string StripComments(const string &text) {
+    string ret = text;
+    for (size_t i = 0, n = ret.size(); i < n; i++) {
+      if (ret[i] == '/' && i+1 < n && ret[i+1] == '/') { for (; i < n && ret[i] != '\n'; i++) ret[i] = ' '; }
+      else if (ret[i] == '/' && i+1 < n && ret[i+1] == '*') {
+        size_t close = ret.find("*/", i+2), e = close == string::npos ? n : close + 2;
+        for (; i < e; i++) if (ret[i] != '\n') ret[i] = ' ';
+        i--;
+      } else if (ret[i] == '"' || ret[i] == '\'') {
+        for (char q = ret[i++]; i < n && ret[i] != q && ret[i] != '\n'; i++) {
+          if (ret[i] == '\\' && i+1 < n) ret[i++] = ' ';
+          ret[i] = ' ';
+        }
+      }
+    }
+    return ret;
+  }
+
+  // Whether a second inclusion of the header is a no-op: it has #pragma once, or all of
+  // it sits in one #ifndef X / #define X ... #endif.  assert.h is meant to be included
+  // repeatedly, and has no guard.
+  static bool IncludeGuarded(const string &fn) {
+    size_t slash = fn.rfind('/');
+    if (fn.compare(slash == string::npos ? 0 : slash + 1, string::npos, "assert.h") == 0) return true;
+    ifstream in(fn, ios::binary);
+    if (!in) return false;
+    string text = StripComments(string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>()));
+    vector<string> line;
+    for (size_t i = 0, e; i < text.size(); i = e + 1) {
+      if ((e = text.find('\n', i)) == string::npos) e = text.size();
+      size_t b = text.find_first_not_of(" \t\r", i);
+      if (b >= e) continue;
+      string l;
+      for (size_t j = b; j < e; j++) {
+        if (!isspace(text[j])) l += text[j];
+        else if (l.size() && l.back() != ' ' && l.back() != '#') l += ' ';
+      }
+      while (l.size() && l.back() == ' ') l.pop_back();
+      if (l == "#pragma once") return true;
+      line.push_back(move(l));
+    }
+    if (line.size() < 3 || line.back() != "#endif") return false;
+    string guard;
+    if      (PrefixMatch(line[0], "#ifndef "))      guard = line[0].substr(8);
+    else if (PrefixMatch(line[0], "#if !defined")) guard = line[0].substr(12);
+    guard.erase(remove_if(guard.begin(), guard.end(), [](char c){ return c == '(' || c == ')' || c == ' '; }), guard.end());
+    if (guard.empty() || !PrefixMatch(line[1], StrCat("#define ", guard)) ||
+        (line[1].size() > guard.size() + 8 && line[1][guard.size() + 8] != ' ')) return false;
+    int depth = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+      if      (PrefixMatch(line[i], "#if"))    depth++;
+      else if (PrefixMatch(line[i], "#endif")) depth--;
+      if (!depth && i + 1 < line.size()) return false;
+    }
+    return true;
+  }
+
+  static string Extension(const string &fn) {
+    size_t dot = fn.rfind('.');
+    return dot == string::npos ? "" : fn.substr(dot + 1);
+  }
+
+  static bool IsSourceFile(const string &fn) {
+    static const unordered_set<string> ext{ "c", "cc", "cp", "cpp", "cxx", "c++", "m", "mm" };
+    return fn.size() && fn[0] != '-' && ext.count(Extension(fn));
+  }
+
+  static string HeaderLanguage(const string &fn) {
+    string ext = Extension(fn);
+    if (ext == "c")  return "c-header";
+    if (ext == "m")  return "objective-c-header";
+    if (ext == "mm") return "objective-c++-header";
+    return "c++-header";
+  }
+
+  // Splits a compile command the way a shell would, minding quotes and backslashes.
+  static vector<string> SplitArgs(const string &cmd) {
+    vector<string> ret;
+    string arg;
+    bool in_arg = false;
+    for (size_t i = 0; i < cmd.size(); ++i) {
+      char c = cmd[i];
+      if (isspace(c)) { if (in_arg) ret.push_back(move(arg)); arg.clear(); in_arg = false; continue; }
+      in_arg = true;
+      if (c == '\\' && i + 1 < cmd.size()) arg += cmd[++i];
+      else if (c == '\'') { size_t e = cmd.find('\'', i + 1); if (e == string::npos) e = cmd.size(); arg.append(cmd, i + 1, e - i - 1); i = e; }
+      else if (c == '"') {
+        for (++i; i < cmd.size() && cmd[i] != '"'; ++i) {
+          if (cmd[i] == '\\' && i + 1 < cmd.size() && (cmd[i+1] == '"' || cmd[i+1] == '\\')) ++i;
+          arg += cmd[i];
+        }
+      } else arg += c;
+    }
+    if (in_arg) ret.push_back(move(arg));
+    return ret;
+  }
+
+  static string QuoteArg(const string &arg) {
+    string ret = "\"";
+    for (char c : arg) { if (c == '"' || c == '\\') ret += '\\'; ret += c; }
+    return ret + "\"";
+  }
+
+  // Compile flags minus the compiler, the source file and its outputs.
+  static vector<string> GetFlags(const string &compile_cmd, const string &filename) {
+    vector<string> arg = SplitArgs(compile_cmd), ret;
+    for (size_t i = 1; i < arg.size(); ++i) {
+      if (arg[i] == "-c") continue;
+      if (arg[i] == "-o" || arg[i] == "-MF" || arg[i] == "-MT" || arg[i] == "-MQ") { ++i; continue; }
+      if (arg[i] == "-MD" || arg[i] == "-MMD") continue;
+      if (arg[i] == filename || IsSourceFile(arg[i])) continue;
+      ret.push_back(arg[i]);
+    }
+    return ret;
+  }
+
+  static vector<string> ParseDepFile(const string &fn) {
+    ifstream in(fn);
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>()), dep;
+    vector<string> ret;
+    size_t colon = text.find(": ");
+    if (colon == string::npos) return ret;
+    for (size_t i = colon + 2; i <= text.size(); ++i) {
+      char c = i < text.size() ? text[i] : ' ';
+      if (c == '\\' && i + 1 < text.size() && text[i+1] == ' ') { dep += ' '; ++i; }
+      else if (c == '\\' && i + 1 < text.size() && (text[i+1] == '\n' || text[i+1] == '\r')) continue;
+      else if (isspace(c)) { if (dep.size()) ret.push_back(move(dep)); dep.clear(); }
+      else dep += c;
+    }
+    return ret;
+  }
+
+  // A header that was only touched keeps the PCH, with its new mtime noted.  A manifest
+  // that doesn't parse to its end, as one from before guards were noted, is stale.
+  bool ValidManifest(const string &fn, bool *guarded) {
+    ifstream in(fn);
+    if (!in) return false;
+    bool rewrite = false;
+    vector<Header> headers;
+    *guarded = true;
+    for (Header h; in >> h.size >> h.mtime >> hex >> h.hash >> dec >> h.guarded && getline(in >> ws, h.fn); ) {
+      if (!h.guarded) *guarded = false;
+      long long size, mtime;
+      if (!StatFile(h.fn, &size, &mtime)) return false;
+      if (size != h.size || mtime != h.mtime) {
+        unsigned long long hash;
+        if (size != h.size || !HashFile(h.fn, &hash) || hash != h.hash) return false;
+        h.mtime = mtime;
+        rewrite = true;
+      }
+      headers.push_back(h);
+    }
+    if (!in.eof()) return false;
+    if (rewrite) WriteManifest(fn, headers);
+    return true;
+  }
+
+  // Lookups of one key may rewrite its manifest at once, so each writes its own temp file.
+  static void WriteManifest(const string &fn, const vector<Header> &headers) {
+    string tmp = StrCat(fn, ".", getpid(), ".", hash<thread::id>()(this_thread::get_id()), ".tmp");
+    {
+      ofstream out(tmp);
+      for (auto &h : headers) out << h.size << " " << h.mtime << " " << hex << h.hash << dec << " " << h.guarded << " " << h.fn << "\n";
+    }
+    rename(tmp.c_str(), fn.c_str());
+  }
+
+  // Returns compile_cmd with -include-pch added if the preamble's PCH is built, current
+  // and guarded, else starts building it if need be and returns compile_cmd as is.
+  // Called from the thread pool.
+  string AddPrecompiledPreamble(const string &compile_cmd, const string &compile_dir,
+                                const string &filename, const string &text) {
+    string preamble = GetPreamble(text);
+    if (preamble.find("#include") == string::npos) return compile_cmd;
+    vector<string> flags = GetFlags(compile_cmd, filename);
+    string lang = HeaderLanguage(filename), key_text = lang;
+    for (auto &f : flags) StrAppend(&key_text, " ", f);
+    StrAppend(&key_text, "\n", compile_dir, "\n", preamble);
+    string key = HexFNV64(FNV64(key_text.data(), key_text.size())), base = StrCat(dir, key);
+    string pch = StrCat(base, ".pch"), manifest = StrCat(base, ".deps");
+
+    long long size, mtime;
+    bool guarded;
+    if (!Building(key, nullptr) && StatFile(pch, &size, &mtime) && ValidManifest(manifest, &guarded)) {
+      if (!guarded) { unguarded++; return compile_cmd; }
+      hits++;
+      return StrCat(compile_cmd, " -include-pch ", QuoteArg(pch));
+    }
+    misses++;
+    if (Building(key, &filename)) return compile_cmd;
+    run_cb([=](){
+      bool built = BuildPreamble(base, lang, flags, compile_dir, preamble);
+      vector<string> waiting;
+      { ScopedMutex l(lock); auto b = building.find(key); waiting = move(b->second); building.erase(b); }
+      if (built) for (auto &fn : waiting) built_cb(fn);
+    });
+    return compile_cmd;
+  }
+
+  // Whether key is being built.  If waiter is given it's added to those told when the
+  // build lands, starting the build if there's none.
+  bool Building(const string &key, const string *waiter) {
+    ScopedMutex l(lock);
+    auto b = building.find(key);
+    if (!waiter) return b != building.end();
+    bool ret = b != building.end();
+    auto &waiting = ret ? b->second : building[key];
+    if (find(waiting.begin(), waiting.end(), *waiter) == waiting.end()) waiting.push_back(*waiter);
+    return ret;
+  }
+
+  // The manifest goes first and comes back last, so no lookup pairs a new PCH with the
+  // old manifest or the reverse.
+  bool BuildPreamble(const string &base, const string &lang, const vector<string> &flags,
+                     const string &compile_dir, const string &preamble) {
+    string pch = StrCat(base, ".pch"), manifest = StrCat(base, ".deps");
+    string src = StrCat(base, ".h"), dep = StrCat(base, ".d"), tmp = StrCat(pch, ".tmp");
+    unlink(manifest.c_str());
+    { ofstream out(src); out << preamble; }
+    vector<const char*> argv{ clang_bin.c_str(), "-x", lang.c_str(), "-Xclang", "-fno-pch-timestamp" };
+    for (auto &f : flags) argv.push_back(f.c_str());
+    for (auto a : { "-MD", "-MF", dep.c_str(), "-o", tmp.c_str(), src.c_str() }) argv.push_back(a);
+    argv.push_back(nullptr);
+
+    ProcessPipe process;
+    if (process.Open(&argv[0], compile_dir.c_str())) { failures++; return false; }
+    for (char buf[1024]; fgets(buf, sizeof(buf), process.in); ) {}
+    process.Close();
+    long long size, mtime;
+    if (!StatFile(tmp, &size, &mtime) || !size) {
+      ERROR("build preamble ", src, " failed");
+      failures++;
+      return false;
+    }
+
+    vector<Header> headers;
+    for (auto &d : ParseDepFile(dep)) {
+      Header h;
+      h.fn = d[0] == '/' ? d : StrCat(compile_dir, "/", d);
+      if (h.fn == src) continue;
+      if (!StatFile(h.fn, &h.size, &h.mtime) || !HashFile(h.fn, &h.hash)) { failures++; return false; }
+      h.guarded = IncludeGuarded(h.fn);
+      headers.push_back(move(h));
+    }
+    rename(tmp.c_str(), pch.c_str());
+    WriteManifest(manifest, headers);
+    INFO("built preamble ", pch, " from ", headers.size(), " headers");
+    return true;
+  }
+
+  string StatsString() const {
+    size_t builds;
+    { ScopedMutex l(lock); builds = building.size(); }
+    return StrCat("dir=", dir, " building=", builds, " hits=", hits.load(), " misses=", misses.load(), " failures=", failures.load(),
+                  " unguarded=", unguarded.load());
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_PREAMBLE_CACHE_H__
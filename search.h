@@ -0,0 +1,146 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_SEARCH_H__
+#define LFL_EDITOR_SEARCH_H__
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+namespace LFL {
+
+// Line-oriented search used by Find and Find in Files.  A literal that every match must
+// contain is pulled out of the pattern and located with a vectorized scan; the regex
+// only runs on lines holding a candidate.
+struct TextSearch {
+  typedef function<void(const char *b, const char *e, vector<int> *cols)> LineMatcher;
+  typedef function<void(int line, int col, const char *b, const char *e)> MatchCB;
+
+  // Longest run of characters every match of pattern must contain, or "" when the
+  // pattern has top-level alternation or no usable run.
+  static string RequiredLiteral(const string &pattern, bool *pure_literal=nullptr) {
+    string best, run;
+    bool pure = true;
+    int depth = 0;
+    auto end_run = [&](){ if (run.size() > best.size()) best = run; run.clear(); };
+    for (size_t i = 0; i < pattern.size(); i++) {
+      char c = pattern[i], next = i+1 < pattern.size() ? pattern[i+1] : 0;
+      bool optional = next == '*' || next == '?' || (next == '{' && i+2 < pattern.size() && pattern[i+2] == '0');
+      if (c == '|') { if (!depth) { if (pure_literal) *pure_literal = false; return ""; } pure = false; end_run(); continue; }
+      if (c == '(') { depth++; pure = false; end_run(); continue; }
+      if (c == ')') { depth--; pure = false; end_run(); continue; }
+      if (c == '\\' && next) {
+        i++;
+        if (!strchr(".^$|()[]{}*+?\\/-", next)) { pure = false; end_run(); continue; }
+        c = next;
+        next = i+1 < pattern.size() ? pattern[i+1] : 0;
+        optional = next == '*' || next == '?';
+      } else if (strchr(".^$[]{}*+?", c)) {
+        pure = false;
+        end_run();
+        if (c == '[' || c == '{') for (char close = c == '[' ? ']' : '}'; i+1 < pattern.size() && pattern[++i] != close; ) {}
+        continue;
+      }
+      if (depth) { pure = false; continue; }
+      if (optional) { pure = false; end_run(); continue; }
+      run += c;
+      if (next == '+') { pure = false; end_run(); }
+    }
+    end_run();
+    if (pure_literal) *pure_literal = pure && best.size();
+    return best;
+  }
+
+  static const char *FindLiteral(const char *b, const char *e, const string &lit) {
+    size_t n = lit.size();
+    if (!n) return b;
+    if (size_t(e - b) < n) return e;
+    const char *last = e - n + 1;
+#ifdef __SSE2__
+    const __m128i first_c = _mm_set1_epi8(lit[0]), last_c = _mm_set1_epi8(lit[n-1]);
+    for (; b + 16 <= last; b += 16) {
+      __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+      __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + n - 1));
+      for (unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first_c), _mm_cmpeq_epi8(l, last_c)));
+           mask; mask &= mask - 1) {
+        const char *p = b + __builtin_ctz(mask);
+        if (!memcmp(p + 1, lit.data() + 1, n - 1)) return p;
+      }
+    }
+#endif
+    for (; b < last; b++) {
+      if (!(b = static_cast<const char*>(memchr(b, lit[0], last - b)))) return e;
+      if (!memcmp(b + 1, lit.data() + 1, n - 1)) return b;
+    }
+    return e;
+  }
+
+  static int CountNewlines(const char *b, const char *e) {
+    int ret = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; b + 16 <= e; b += 16)
+      ret += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)), nl)));
+#endif
+    for (; b < e; b++) ret += *b == '\n';
+    return ret;
+  }
+
+  // Calls out for each match in order.  Returns false if cancel was raised.
+  static bool Search(const char *b, const char *e, const string &literal, const LineMatcher &matcher,
+                     const atomic<bool> *cancel, const MatchCB &out) {
+    vector<int> cols;
+    int line = 0, checked = 0;
+    for (const char *counted = b, *p = b; p < e; ) {
+      const char *hit = literal.size() ? FindLiteral(p, e, literal) : p;
+      if (hit == e) break;
+      const char *lb = hit;
+      while (lb > p && lb[-1] != '\n') lb--;
+      const char *le = static_cast<const char*>(memchr(hit, '\n', e - hit));
+      if (!le) le = e;
+      line += CountNewlines(counted, lb);
+      counted = lb;
+      cols.clear();
+      matcher(lb, le, &cols);
+      for (auto c : cols) out(line, c, lb, le);
+      p = le + 1;
+      if (!(++checked % 1024) && cancel && *cancel) return false;
+    }
+    return !(cancel && *cancel);
+  }
+
+  static LineMatcher MakeLineMatcher(const string &pattern, bool literal) {
+    if (literal) return [=](const char *b, const char *e, vector<int> *cols) {
+      for (const char *p = b; (p = FindLiteral(p, e, pattern)) != e; p += pattern.size()) cols->push_back(p - b);
+    };
+    auto dfa = make_shared<DFARegex>(vector<string>{ pattern });
+    if (!dfa->Empty()) return [=](const char *b, const char *e, vector<int> *cols) {
+      dfa->MatchAll(b, e, [&](int begin, int, int){ cols->push_back(begin); });
+    };
+    auto regex = make_shared<Regex>(pattern);
+    return [=](const char *b, const char *e, vector<int> *cols) {
+      vector<pair<int, int>> matches;
+      RegexLineMatcher(regex.get(), string(b, e)).MatchAll(&matches);
+      for (auto &m : matches) cols->push_back(m.second);
+    };
+  }
+
+  static bool IsBinary(const string &text) { return memchr(text.data(), 0, min(text.size(), size_t(8192))); }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_SEARCH_H__
@@ -0,0 +1,141 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_SESSION_H__
+#define LFL_EDITOR_SESSION_H__
+namespace LFL {
+
+// What the editor showed when it last exited: the open tabs with their cursors and the
+// clang spans of the lines on screen, the CMake targets, and the default target's build
+// settings.  Restoring shows these at once, and the parse and the CMake daemon replace
+// them as they land.  A tab's spans are dropped if its file's size or mtime moved since.
+struct Session {
+  static const int version = 2;
+  struct Tab {
+    string filename;
+    int cursor_line=0, cursor_col=0, first_line=0;
+    long long size=0, mtime=0;
+    vector<pair<int, DrawableAnnotation>> annotation;
+  };
+  vector<Tab> tab;
+  string top;
+  vector<string> targets;
+  struct Target {
+    string name, output;
+    vector<string> compile_definitions, compile_options, include_directories;
+  } default_target;
+
+  string Serialize() const {
+    string ret = StrCat("tepidfusion-session ", int(version), "\n");
+    auto Str = [&](const string &s){ StrAppend(&ret, s.size(), "\n", s, "\n"); };
+    for (auto &t : tab) {
+      StrAppend(&ret, "tab ", t.cursor_line, " ", t.cursor_col, " ", t.first_line, " ", t.size, " ", t.mtime,
+                " ", t.annotation.size(), " ");
+      Str(t.filename);
+      for (auto &a : t.annotation) {
+        StrAppend(&ret, a.first, " ", a.second.size());
+        for (auto &span : a.second) StrAppend(&ret, " ", span.first, " ", span.second);
+        ret += "\n";
+      }
+    }
+    for (auto &t : targets) { ret += "target "; Str(t); }
+    if (default_target.name.size()) {
+      auto List = [&](const vector<string> &l){ StrAppend(&ret, l.size(), "\n"); for (auto &s : l) Str(s); };
+      ret += "default ";
+      Str(default_target.name);
+      Str(default_target.output);
+      List(default_target.compile_definitions);
+      List(default_target.compile_options);
+      List(default_target.include_directories);
+    }
+    ret += "top ";
+    Str(top);
+    return ret;
+  }
+
+  bool Parse(const string &text) {
+    istringstream in(text);
+    string type;
+    int v = 0;
+    if (!(in >> type >> v) || type != "tepidfusion-session" || v < 1 || v > version) return false;
+    auto Str = [&](string *out){
+      size_t len;
+      if (!(in >> len) || in.get() != '\n') return false;
+      out->resize(len);
+      return (!len || in.read(&(*out)[0], len)) && in.get() == '\n';
+    };
+    while (in >> type) {
+      if (type == "tab") {
+        Tab t;
+        size_t lines;
+        if (!(in >> t.cursor_line >> t.cursor_col >> t.first_line >> t.size >> t.mtime >> lines) || !Str(&t.filename)) return false;
+        for (size_t i = 0, spans; i < lines; i++) {
+          t.annotation.emplace_back();
+          auto &a = t.annotation.back();
+          if (!(in >> a.first >> spans)) return false;
+          a.second.resize(spans);
+          for (auto &span : a.second) if (!(in >> span.first >> span.second)) return false;
+        }
+        tab.push_back(move(t));
+      }
+      else if (type == "target") { targets.emplace_back(); if (!Str(&targets.back())) return false; }
+      else if (type == "top")    { if (!Str(&top)) return false; }
+      else if (type == "default") {
+        auto List = [&](vector<string> *l){
+          size_t n;
+          if (!(in >> n) || in.get() != '\n') return false;
+          l->resize(n);
+          for (auto &s : *l) if (!Str(&s)) return false;
+          return true;
+        };
+        auto &t = default_target;
+        if (!Str(&t.name) || !Str(&t.output) || !List(&t.compile_definitions) || !List(&t.compile_options) ||
+            !List(&t.include_directories)) return false;
+      }
+      else return false;
+    }
+    return true;
+  }
+
+  bool Load(const string &fn) {
+    ifstream in(fn, ios::binary);
+    return in && Parse(string(istreambuf_iterator<char>(in), istreambuf_iterator<char>()));
+  }
+
+  bool Save(const string &fn) const { return AtomicFile::Write(fn, Serialize()); }
+};
+
+// Time from launch to each startup phase, in the order reached.
+struct StartupTimer {
+  Time start = Now();
+  vector<pair<string, Time>> phase;
+
+  void Mark(const string &name) {
+    for (auto &p : phase) if (p.first == name) return;
+    phase.emplace_back(name, Now() - start);
+  }
+
+  string StatsString() const {
+    string ret;
+    for (auto &p : phase) StrAppend(&ret, ret.size() ? " " : "", p.first, "_ms=", chrono::duration_cast<chrono::milliseconds>(p.second).count());
+    return ret;
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_SESSION_H__
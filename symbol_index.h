@@ -0,0 +1,528 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_SYMBOL_INDEX_H__
+#define LFL_EDITOR_SYMBOL_INDEX_H__
+namespace LFL {
+
+// Read-only view of an index: the base file, then the segments appended to its log since
+// the base was last written.  Each segment's definitions and references are sorted by
+// name, so a lookup is two binary searches per segment.  A file listed by a later
+// segment replaces its entries in earlier ones, and a file with size -1 was removed.
+struct MappedSymbolIndex {
+  static const unsigned magic = 0x49534654, version = 1;
+  struct Header { unsigned magic, version, files, defs, refs, strings; };
+  struct File { unsigned name, name_len; long long mtime, size; };
+  struct Entry { unsigned name, name_len, scope, scope_len, file, line, col, kind; };
+  struct Location { string fn, name, scope; int line, col, kind; };
+
+  struct Segment {
+    const Header *header=0;
+    const File *file=0;
+    const Entry *def=0, *ref=0;
+    const char *strings=0;
+    vector<bool> live;
+
+    // Returns the segment's length, or 0 if data doesn't start with a whole segment.
+    size_t Parse(const char *data, size_t size) {
+      if (size < sizeof(Header)) return 0;
+      auto h = reinterpret_cast<const Header*>(data);
+      if (h->magic != magic || h->version != version) return 0;
+      size_t strings_offset = sizeof(Header) + size_t(h->files) * sizeof(File) + (size_t(h->defs) + h->refs) * sizeof(Entry);
+      if (strings_offset + h->strings > size) return 0;
+      header = h;
+      file = reinterpret_cast<const File*>(data + sizeof(Header));
+      def = reinterpret_cast<const Entry*>(file + header->files);
+      ref = def + header->defs;
+      strings = data + strings_offset;
+      return strings_offset + h->strings;
+    }
+
+    const char *String(unsigned offset) const { return strings + offset; }
+    string FileName(unsigned i) const { return string(String(file[i].name), file[i].name_len); }
+    string Name(const Entry &e) const { return string(String(e.name), e.name_len); }
+    Location GetLocation(const Entry &e) const {
+      return Location{ FileName(e.file), Name(e), string(String(e.scope), e.scope_len), int(e.line), int(e.col), int(e.kind) };
+    }
+
+    pair<const Entry*, const Entry*> EqualRange(const Entry *b, const Entry *e, const string &name) const {
+      auto less = [&](const Entry &x, const string &n) { return n.compare(0, string::npos, String(x.name), x.name_len) > 0; };
+      auto greater = [&](const string &n, const Entry &x) { return n.compare(0, string::npos, String(x.name), x.name_len) < 0; };
+      return make_pair(lower_bound(b, e, name, less), upper_bound(b, e, name, greater));
+    }
+  };
+
+  string filename, log;
+  const char *data=0;
+  size_t size=0, base_size=0, log_size=0;
+  vector<Segment> segment;
+#ifdef LFL_WINDOWS
+  string buf;
+#else
+  int fd=-1;
+#endif
+
+  MappedSymbolIndex(const string &fn) : filename(fn) {}
+  ~MappedSymbolIndex() {
+#ifndef LFL_WINDOWS
+    if (data) munmap(const_cast<char*>(data), size);
+    if (fd >= 0) close(fd);
+#endif
+  }
+
+  static string LogName(const string &fn) { return StrCat(fn, ".log"); }
+
+  // The log is read whole, and only up to the first torn segment.
+  bool Open() {
+#ifdef LFL_WINDOWS
+    ifstream in(filename, ios::binary);
+    buf.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    data = buf.data();
+    size = buf.size();
+#else
+    struct stat s;
+    if ((fd = open(filename.c_str(), O_RDONLY)) >= 0 && !fstat(fd, &s) && (size = s.st_size)) {
+      void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) data = static_cast<const char*>(p);
+    }
+#endif
+    Segment base;
+    if (data && base.Parse(data, size) == size) { segment.push_back(base); base_size = size; }
+    ifstream in(LogName(filename), ios::binary);
+    log.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    for (size_t len; log_size < log.size(); log_size += len) {
+      Segment s;
+      if (!(len = s.Parse(log.data() + log_size, log.size() - log_size))) break;
+      segment.push_back(s);
+    }
+
+    unordered_map<string, size_t> latest;
+    for (size_t i = 0; i < segment.size(); i++)
+      for (unsigned j = 0; j < segment[i].header->files; j++) latest[segment[i].FileName(j)] = i;
+    for (size_t i = 0; i < segment.size(); i++) {
+      auto &s = segment[i];
+      s.live.resize(s.header->files);
+      for (unsigned j = 0; j < s.header->files; j++) s.live[j] = s.file[j].size >= 0 && latest[s.FileName(j)] == i;
+    }
+    return segment.size();
+  }
+
+  vector<Location> FindDefinitions(const string &name) const { return Find(name, true); }
+  vector<Location> FindReferences (const string &name) const { return Find(name, false); }
+
+  vector<Location> Find(const string &name, bool defs) const {
+    vector<Location> ret;
+    for (auto &s : segment) {
+      auto r = defs ? s.EqualRange(s.def, s.def + s.header->defs, name) : s.EqualRange(s.ref, s.ref + s.header->refs, name);
+      for (auto i = r.first; i != r.second; ++i) if (s.live[i->file]) ret.push_back(s.GetLocation(*i));
+    }
+    return ret;
+  }
+
+  vector<Location> SearchSymbols(const string &query, size_t max_results) const {
+    vector<Location> prefix, substring;
+    string q = ToLower(query);
+    for (auto &s : segment)
+      for (const Entry *i = s.def, *e = s.def + s.header->defs; i != e && prefix.size() < max_results; ++i) {
+        if (!s.live[i->file]) continue;
+        string name = ToLower(s.Name(*i));
+        size_t found = name.find(q);
+        if      (found == 0)            prefix   .push_back(s.GetLocation(*i));
+        else if (found != string::npos) substring.push_back(s.GetLocation(*i));
+      }
+    for (auto &l : substring) { if (prefix.size() >= max_results) break; prefix.push_back(move(l)); }
+    return prefix;
+  }
+
+  static string ToLower(string x) { for (auto &c : x) c = tolower(c); return x; }
+};
+
+// Lexical C/C++ indexer: a token scanner with a scope stack finds namespace, type,
+// function, typedef and macro definitions, and every non-keyword identifier is kept as
+// a reference.  Per-file results are kept so an update re-scans only changed files.
+struct SymbolIndex {
+  enum { Namespace=1, Class, Struct, Union, Enum, Function, Typedef, Macro };
+  struct Symbol { unsigned name, scope; int line, col, kind; };
+  struct FileRecord { long long mtime=0, size=0; vector<Symbol> defs, refs; };
+  struct Token { string text; int line, col; bool ident; };
+
+  string filename;
+  vector<string> names;
+  vector<unsigned> name_refs, free_names;
+  unordered_map<string, unsigned> name_id;
+  map<string, FileRecord> files;
+  size_t base_size=0, log_size=0;
+  bool loaded=0;
+  SymbolIndex(const string &fn) : filename(fn) { Intern(""); }
+
+  // Names are counted per use, so replacing a file's symbols frees the names no other
+  // file uses, and their ids are reused.  Id 0, the empty name, is never freed.
+  unsigned Intern(const string &n) {
+    auto i = name_id.find(n);
+    unsigned id;
+    if (i != name_id.end()) id = i->second;
+    else if (free_names.size()) { id = free_names.back(); free_names.pop_back(); names[id] = n; name_id[n] = id; }
+    else { id = names.size(); names.push_back(n); name_refs.push_back(0); name_id[n] = id; }
+    name_refs[id]++;
+    return id;
+  }
+
+  void Release(unsigned id) {
+    if (!id || --name_refs[id]) return;
+    name_id.erase(names[id]);
+    string().swap(names[id]);
+    free_names.push_back(id);
+  }
+
+  void Release(const FileRecord &f) {
+    for (auto &s : f.defs) { Release(s.name); Release(s.scope); }
+    for (auto &s : f.refs) Release(s.name);
+  }
+
+  static const char *KindName(int k) {
+    static const char *name[] = { "", "namespace", "class", "struct", "union", "enum", "function", "typedef", "macro" };
+    return (k >= 0 && k <= Macro) ? name[k] : "";
+  }
+
+  static bool IsKeyword(const string &x) {
+    static const unordered_set<string> keywords{
+      "alignas", "alignof", "asm", "auto", "bool", "break", "case", "catch", "char", "char16_t", "char32_t", "class",
+      "const", "constexpr", "const_cast", "continue", "decltype", "default", "delete", "do", "double", "dynamic_cast",
+      "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if", "inline", "int",
+      "long", "mutable", "namespace", "new", "noexcept", "nullptr", "operator", "private", "protected", "public",
+      "register", "reinterpret_cast", "return", "short", "signed", "sizeof", "static", "static_assert", "static_cast",
+      "struct", "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+      "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while", "override", "final" };
+    return keywords.count(x);
+  }
+
+  static vector<Token> Tokenize(const string &text, vector<Token> *macros) {
+    vector<Token> ret;
+    int line = 1;
+    size_t line_start = 0, n = text.size();
+    bool line_begin = true;
+    for (size_t i = 0; i < n; ) {
+      char c = text[i];
+      if (c == '\n') { line++; line_start = ++i; line_begin = true; continue; }
+      if (isspace(c)) { i++; continue; }
+      if (c == '/' && i+1 < n && text[i+1] == '/') { while (i < n && text[i] != '\n') i++; continue; }
+      if (c == '/' && i+1 < n && text[i+1] == '*') {
+        for (i += 2; i < n && !(text[i] == '*' && i+1 < n && text[i+1] == '/'); i++)
+          if (text[i] == '\n') { line++; line_start = i+1; }
+        i += 2;
+        continue;
+      }
+      if (c == '#' && line_begin) {
+        size_t d = text.find_first_not_of(" \t", i+1), e = d;
+        while (e < n && isalpha(text[e])) e++;
+        if (d < n && text.compare(d, e-d, "define") == 0) {
+          size_t b = text.find_first_not_of(" \t", e), ne = b;
+          while (ne < n && (isalnum(text[ne]) || text[ne] == '_')) ne++;
+          if (b < n && ne > b) macros->push_back(Token{ text.substr(b, ne-b), line, int(b - line_start) + 1, true });
+        }
+        for (; i < n && text[i] != '\n'; i++)
+          if (text[i] == '\\' && i+1 < n && text[i+1] == '\n') { line++; line_start = ++i + 1; }
+        continue;
+      }
+      line_begin = false;
+      if (c == '"' || c == '\'') {
+        for (i++; i < n && text[i] != c && text[i] != '\n'; i++) if (text[i] == '\\') i++;
+        i++;
+        continue;
+      }
+      if (isalpha(c) || c == '_') {
+        size_t b = i;
+        while (i < n && (isalnum(text[i]) || text[i] == '_')) i++;
+        ret.push_back(Token{ text.substr(b, i-b), line, int(b - line_start) + 1, true });
+        continue;
+      }
+      if (isdigit(c)) { while (i < n && (isalnum(text[i]) || text[i] == '.' || text[i] == '\'')) i++; continue; }
+      if (c == ':' && i+1 < n && text[i+1] == ':') { ret.push_back(Token{ "::", line, int(i - line_start) + 1, false }); i += 2; continue; }
+      if (c == '-' && i+1 < n && text[i+1] == '>') { ret.push_back(Token{ "->", line, int(i - line_start) + 1, false }); i += 2; continue; }
+      ret.push_back(Token{ string(1, c), line, int(i - line_start) + 1, false });
+      i++;
+    }
+    return ret;
+  }
+
+  static size_t SkipBalanced(const vector<Token> &t, size_t i) {
+    string open = t[i].text, close = open == "(" ? ")" : open == "{" ? "}" : open == "[" ? "]" : ">";
+    for (int depth = 0; i < t.size(); i++) {
+      if      (t[i].text == open) depth++;
+      else if (t[i].text == close && !--depth) return i;
+    }
+    return i;
+  }
+
+  // After a parameter list's ')' returns the index of the body's '{', or 0 if this is
+  // a declaration, call or macro invocation rather than a definition.
+  static size_t FindFunctionBody(const vector<Token> &t, size_t i) {
+    static const unordered_set<string> qualifiers{ "const", "volatile", "noexcept", "override", "final", "&", "&&", "throw" };
+    for (i++; i < t.size(); i++) {
+      const string &x = t[i].text;
+      if (x == "{") return i;
+      if (x == "(") { i = SkipBalanced(t, i); continue; }
+      if (qualifiers.count(x)) continue;
+      if (x == "->") { while (i+1 < t.size() && t[i+1].text != "{" && t[i+1].text != ";") i++; continue; }
+      if (x == ":") {
+        for (i++; i < t.size(); i++) {
+          if (t[i].text == "(" || (t[i].text == "{" && i && (t[i-1].ident || t[i-1].text == ">"))) i = SkipBalanced(t, i);
+          else if (t[i].text == "{") return i;
+          else if (t[i].text == ";") return 0;
+        }
+        return 0;
+      }
+      return 0;
+    }
+    return 0;
+  }
+
+  void IndexText(const string &text, FileRecord *out) {
+    enum { Other, Container, Body };
+    struct Scope { int type; string name; };
+    vector<Token> macros, t = Tokenize(text, &macros);
+    vector<Scope> scope;
+    string pending_name;
+    int pending = Other, typedef_depth = -1;
+    size_t pending_brace = 0;
+    auto scope_name = [&](const string &qualifier) {
+      string ret;
+      for (auto &s : scope) if (s.type == Container && s.name.size()) ret += (ret.size() ? "::" : "") + s.name;
+      if (qualifier.size()) ret += (ret.size() ? "::" : "") + qualifier;
+      return ret;
+    };
+    auto add_def = [&](const Token &tok, int kind, const string &qualifier) {
+      out->defs.push_back(Symbol{ Intern(tok.text), Intern(scope_name(qualifier)), tok.line, tok.col, kind });
+    };
+    for (auto &m : macros) add_def(m, Macro, "");
+
+    for (size_t i = 0; i < t.size(); i++) {
+      const string &x = t[i].text;
+      bool in_body = scope.size() && scope.back().type == Body;
+      if (x == "{") {
+        if (i == pending_brace && pending != Other) scope.push_back(Scope{ pending, pending_name });
+        else scope.push_back(Scope{ in_body ? Body : Other, "" });
+        pending = Other;
+        continue;
+      }
+      if (x == "}") { if (scope.size()) scope.pop_back(); continue; }
+      if (x == ";" && typedef_depth == int(scope.size())) {
+        if (t[i-1].ident) add_def(t[i-1], Typedef, "");
+        typedef_depth = -1;
+      }
+      if (!t[i].ident) continue;
+      if (!IsKeyword(x)) out->refs.push_back(Symbol{ Intern(x), 0, t[i].line, t[i].col, 0 });
+      if (in_body || (pending == Body && i < pending_brace)) continue;
+
+      int kind = x == "namespace" ? Namespace : x == "class" ? Class : x == "struct" ? Struct :
+        x == "union" ? Union : x == "enum" ? Enum : 0;
+      if (kind) {
+        size_t j = i + 1;
+        if (kind == Enum && j < t.size() && (t[j].text == "class" || t[j].text == "struct")) j++;
+        while (j < t.size() && t[j].text == "[") j = SkipBalanced(t, j) + 1;
+        size_t name = j < t.size() && t[j].ident && !IsKeyword(t[j].text) ? j : 0;
+        for (; j < t.size(); j++) {
+          const string &y = t[j].text;
+          if (y == "<" && kind != Namespace) { j = SkipBalanced(t, j); continue; }
+          if (y == "{" || y == ";" || y == "(" || y == "=" || y == ">" || y == "," || y == ")") break;
+        }
+        if (j < t.size() && t[j].text == "{") {
+          if (name) add_def(t[name], kind, "");
+          pending = Container;
+          pending_name = name ? t[name].text : "";
+          pending_brace = j;
+        }
+        continue;
+      }
+      if (x == "typedef") { typedef_depth = scope.size(); continue; }
+      if (x == "using" && i+2 < t.size() && t[i+1].ident && t[i+2].text == "=") { add_def(t[i+1], Typedef, ""); continue; }
+
+      if (i+1 < t.size() && t[i+1].text == "(" && !IsKeyword(x)) {
+        size_t close = SkipBalanced(t, i+1), body = close < t.size() ? FindFunctionBody(t, close) : 0;
+        if (!body) continue;
+        string qualifier;
+        bool destructor = i && t[i-1].text == "~";
+        for (size_t q = destructor ? i-1 : i; q >= 2 && t[q-1].text == "::" && t[q-2].ident; q -= 2)
+          qualifier = t[q-2].text + (qualifier.size() ? "::" : "") + qualifier;
+        add_def(destructor ? Token{ "~" + x, t[i-1].line, t[i-1].col, true } : t[i], Function, qualifier);
+        pending = Body;
+        pending_brace = body;
+      }
+    }
+  }
+
+  bool IndexFile(const string &fn, FileRecord *out) {
+    ifstream in(fn, ios::binary);
+    if (!in) return false;
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    IndexText(text, out);
+    return true;
+  }
+
+  void Load(const MappedSymbolIndex &m) {
+    loaded = true;
+    base_size = m.base_size;
+    log_size = m.log_size;
+    for (auto &s : m.segment) {
+      vector<FileRecord*> record(s.header->files);
+      for (unsigned i = 0; i < s.header->files; i++) {
+        if (!s.live[i]) continue;
+        auto &f = files[s.FileName(i)];
+        f.mtime = s.file[i].mtime;
+        f.size = s.file[i].size;
+        record[i] = &f;
+      }
+      auto load = [&](const MappedSymbolIndex::Entry &e, vector<Symbol> FileRecord::*out) {
+        if (record[e.file]) (record[e.file]->*out).push_back(Symbol{ Intern(s.Name(e)), Intern(string(s.String(e.scope), e.scope_len)),
+                                                                   int(e.line), int(e.col), int(e.kind) });
+      };
+      for (unsigned i = 0; i < s.header->defs; i++) load(s.def[i], &FileRecord::defs);
+      for (unsigned i = 0; i < s.header->refs; i++) load(s.ref[i], &FileRecord::refs);
+    }
+  }
+
+  // Re-indexes files whose size or mtime changed, drops files no longer listed, and
+  // writes the changes.  Returns the number of files changed, or -1 on error.
+  int Update(const vector<string> &sources) {
+    vector<string> removed;
+    set<string> listed(sources.begin(), sources.end());
+    for (auto i = files.begin(); i != files.end(); ) {
+      if (listed.count(i->first)) ++i;
+      else { Release(i->second); removed.push_back(i->first); i = files.erase(i); }
+    }
+    return Refresh(sources, move(removed));
+  }
+
+  // Re-indexes just the given files if they changed, ie the ones saved since the last
+  // full Update, leaving the rest of the index as it is.
+  int Refresh(const vector<string> &sources, vector<string> changed=vector<string>()) {
+    for (auto &fn : sources) {
+      if (!files.count(fn) && !Indexable(fn)) continue;
+      struct stat s;
+      if (stat(fn.c_str(), &s)) continue;
+      auto &f = files[fn];
+      if (f.mtime == s.st_mtime && f.size == s.st_size && (f.defs.size() || f.refs.size())) continue;
+      FileRecord r;
+      r.mtime = s.st_mtime;
+      r.size = s.st_size;
+      if (IndexFile(fn, &r)) { Release(f); f = move(r); changed.push_back(fn); }
+    }
+    if (changed.size() && !Write(changed)) return -1;
+    return changed.size();
+  }
+
+  static bool Indexable(const string &fn) {
+    static const unordered_set<string> ext{ "c", "cc", "cp", "cpp", "cxx", "c++", "m", "mm", "h", "hh", "hpp", "hxx", "inl", "ipp" };
+    size_t dot = fn.rfind('.');
+    return dot != string::npos && ext.count(fn.substr(dot + 1));
+  }
+
+  // Appends a segment with just the changed files to the log.  Once the log would pass a
+  // quarter of the base, the whole index is written as the new base and the log removed,
+  // so a save costs its own files' symbols plus an occasional compaction.
+  bool Write(const vector<string> &changed) {
+    string segment = Serialize(changed), log = MappedSymbolIndex::LogName(filename);
+    if (!base_size || log_size + segment.size() > base_size / 4) return Compact();
+#ifndef LFL_WINDOWS
+    if (truncate(log.c_str(), log_size) && errno != ENOENT) return false;
+#endif
+    ofstream out(log, ios::binary | ios::app);
+    out.write(segment.data(), segment.size());
+    if (!out) return false;
+    log_size += segment.size();
+    return true;
+  }
+
+  bool Compact() {
+    vector<string> all;
+    for (auto &f : files) all.push_back(f.first);
+    string base = Serialize(all), tmp = StrCat(filename, ".tmp");
+    {
+      ofstream out(tmp, ios::binary);
+      out.write(base.data(), base.size());
+      if (!out) return false;
+    }
+    if (rename(tmp.c_str(), filename.c_str())) return false;
+    unlink(MappedSymbolIndex::LogName(filename).c_str());
+    base_size = base.size();
+    log_size = 0;
+    return true;
+  }
+
+  // One segment for the named files, sorted by name.  Files no longer indexed are listed
+  // with size -1.  The string pool is padded so appended segments stay aligned.
+  string Serialize(const vector<string> &fns) const {
+    typedef MappedSymbolIndex::Entry Entry;
+    vector<MappedSymbolIndex::File> file_table;
+    vector<Entry> def, ref;
+    string pool;
+    unordered_map<unsigned, unsigned> offset;
+    auto add_string = [&](const string &x) { unsigned ret = pool.size(); pool.append(x); return ret; };
+    auto add_name = [&](unsigned id) {
+      auto i = offset.find(id);
+      return i != offset.end() ? i->second : (offset[id] = add_string(names[id]));
+    };
+    for (auto &fn : fns) {
+      unsigned file_id = file_table.size();
+      auto f = files.find(fn);
+      if (f == files.end()) { file_table.push_back(MappedSymbolIndex::File{ add_string(fn), unsigned(fn.size()), 0, -1 }); continue; }
+      file_table.push_back(MappedSymbolIndex::File{ add_string(fn), unsigned(fn.size()), f->second.mtime, f->second.size });
+      for (auto &s : f->second.defs) def.push_back(Entry{ s.name, unsigned(names[s.name].size()), s.scope,
+                                                          unsigned(names[s.scope].size()), file_id, unsigned(s.line), unsigned(s.col), unsigned(s.kind) });
+      for (auto &s : f->second.refs) ref.push_back(Entry{ s.name, unsigned(names[s.name].size()), 0, 0,
+                                                          file_id, unsigned(s.line), unsigned(s.col), 0 });
+    }
+    auto by_name = [&](const Entry &a, const Entry &b) { return names[a.name] < names[b.name]; };
+    stable_sort(def.begin(), def.end(), by_name);
+    stable_sort(ref.begin(), ref.end(), by_name);
+    for (auto &e : def) { e.name = add_name(e.name); e.scope = add_name(e.scope); }
+    for (auto &e : ref) { e.name = add_name(e.name); e.scope = 0; }
+    pool.resize((pool.size() + 7) & ~size_t(7));
+
+    MappedSymbolIndex::Header header{ MappedSymbolIndex::magic, MappedSymbolIndex::version, unsigned(file_table.size()),
+      unsigned(def.size()), unsigned(ref.size()), unsigned(pool.size()) };
+    string ret(reinterpret_cast<const char*>(&header), sizeof(header));
+    ret.append(reinterpret_cast<const char*>(file_table.data()), file_table.size() * sizeof(file_table[0]));
+    ret.append(reinterpret_cast<const char*>(def.data()), def.size() * sizeof(Entry));
+    ret.append(reinterpret_cast<const char*>(ref.data()), ref.size() * sizeof(Entry));
+    ret.append(pool);
+    return ret;
+  }
+
+  // Sources in the project's compile database, plus, with headers, the headers under
+  // source_dir that the project explorer would show, so outside the build dir and not ignored.
+  static vector<string> GetSources(const IDEProject &project, bool headers) {
+    vector<string> ret;
+    for (auto &r : project.build_rules) ret.push_back(r.first);
+    if (headers && project.source_dir.size()) {
+      static const unordered_set<string> header_ext{ "h", "hh", "hpp", "hxx", "inl", "ipp" };
+      IgnoreRules ignore;
+      ignore.AddPrefix(project.build_dir);
+      DirectoryWalker(move(ignore)).Walk(project.source_dir, [&](const string &fn, long long) {
+        size_t dot = fn.rfind('.');
+        if (dot != string::npos && header_ext.count(fn.substr(dot+1))) ret.push_back(fn);
+      });
+    }
+    sort(ret.begin(), ret.end());
+    ret.erase(unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_SYMBOL_INDEX_H__
@@ -0,0 +1,77 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_TAB_BUDGET_H__
+#define LFL_EDITOR_TAB_BUDGET_H__
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+namespace LFL {
+
+// Open tabs in order of last selection, and which background tabs to evict to bring
+// the memory the tabs are estimated to hold back under budget.
+struct TabBudget {
+  struct Tab { string filename; size_t evictable; };
+  size_t budget;
+  long long clock=0, evictions=0, restores=0, evicted_bytes=0;
+  unordered_map<string, long long> last_used;
+  TabBudget(size_t B=0) : budget(B) {}
+
+  void Touch(const string &fn) { last_used[fn] = ++clock; }
+  void Forget(const string &fn) { last_used.erase(fn); }
+
+  // Least recently selected first, skipping tabs with nothing left to evict.
+  vector<Tab> Victims(vector<Tab> tabs, size_t total) const {
+    vector<Tab> ret;
+    if (!budget || total <= budget) return ret;
+    auto LastUsed = [&](const Tab &t){ auto u = last_used.find(t.filename); return u == last_used.end() ? 0 : u->second; };
+    sort(tabs.begin(), tabs.end(), [&](const Tab &a, const Tab &b){ return LastUsed(a) < LastUsed(b); });
+    for (auto &t : tabs) {
+      if (total <= budget) break;
+      if (!t.evictable) continue;
+      total -= min(total, t.evictable);
+      ret.push_back(t);
+    }
+    return ret;
+  }
+
+  void Evicted(const Tab &t) { evictions++; evicted_bytes += t.evictable; }
+
+  // Hands freed pages back to the OS, so evicting shows in RSS.
+  static void ReleaseFreeMemory() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+  }
+
+  static long long ResidentBytes() {
+    long long pages = 0, resident = -1;
+    ifstream statm("/proc/self/statm");
+    if (!(statm >> pages >> resident)) return -1;
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+
+  string StatsString(size_t total) const {
+    long long rss = ResidentBytes();
+    return StrCat("rss_mb=", rss < 0 ? rss : rss >> 20, " tabs_mb=", total >> 20, " budget_mb=", budget >> 20,
+                  " evictions=", evictions, " evicted_mb=", evicted_bytes >> 20, " restores=", restores);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_TAB_BUDGET_H__
@@ -0,0 +1,563 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <regex>
+#include <random>
+#include "core/app/app.h"
+#include "core/app/gl/terminal.h"
+#include "piece_table.h"
+#include "highlight.h"
+#include "tu_scheduler.h"
+#include "dir_walk.h"
+#include "preamble_cache.h"
+#include "dfa_regex.h"
+#include "search.h"
+#include "diff.h"
+#include "build_output.h"
+#include "job_scheduler.h"
+#include "annotation_store.h"
+#include "journal.h"
+#include "undo_log.h"
+
+namespace LFL {
+Application *app;
+int failures = 0;
+
+#define EXPECT(x, ...) if (!(x)) { failures++; ERROR(__FILE__, ":", __LINE__, ": ", #x, " ", __VA_ARGS__); }
+
+// Token rules shaped like the C++ and CMake highlighters', as the bench runs them.
+static const vector<string> cpp_rules = {
+  "\\b(?:if|else|for|while|return|int|char|void|const|auto|string|struct)\\b",
+  "//.*$", "/\\*[^*]*\\*/", "\"(?:[^\"\\\\]|\\\\.)*\"", "'(?:[^'\\\\]|\\\\.)*'",
+  "\\b[0-9]+(?:\\.[0-9]*)?\\b", "^\\s*#\\s*\\w+", "[A-Za-z_]\\w*", "::|->|[-+*/%<>=!&|^~]=?" };
+static const vector<string> cmake_rules = {
+  "#.*$", "\\b(?:if|elseif|else|endif|foreach|endforeach|function|endfunction|macro|endmacro|while|endwhile)\\b",
+  "\\$\\{[^}]*\\}", "\\$<[^>]*>", "\"(?:[^\"\\\\]|\\\\.)*\"", "\\b[A-Z_][A-Z0-9_]*\\b", "[A-Za-z_]\\w*" };
+
+// Real-looking lines, then random ones over the characters the rules care about.
+static vector<string> RegexCorpus(const string &alphabet, const vector<string> &lines) {
+  vector<string> ret = lines;
+  mt19937 rng(7);
+  for (int i = 0; i < 2000; i++) {
+    string line;
+    for (int n = rng() % 24; n; n--) line += alphabet[rng() % alphabet.size()];
+    ret.push_back(line);
+  }
+  return ret;
+}
+
+// Each rule against std::regex, and the rule set against the rules joined by |, which
+// std::regex matches leftmost-first with the first rule to match winning.
+static void TestDFARegexRules(const char *name, const vector<string> &rules, const vector<string> &corpus) {
+  string joined;
+  for (auto &r : rules) StrAppend(&joined, joined.size() ? "|" : "", "(", r, ")");
+  DFARegex set(rules);
+  std::regex set_std(joined);
+  EXPECT(set.unsupported.empty(), name);
+  for (auto &rule : rules) {
+    DFARegex dfa({ rule });
+    std::regex std_rule(rule);
+    for (auto &line : corpus) {
+      const char *b = line.data(), *e = b + line.size(), *mb, *me;
+      int id;
+      std::cmatch m;
+      bool found = dfa.Find(b, e, b, &mb, &me, &id), std_found = std::regex_search(b, e, m, std_rule);
+      EXPECT(found == std_found && (!found || (mb - b == m.position(0) && me - mb == m.length(0))), name, " ", rule, " on ", line);
+    }
+  }
+  for (auto &line : corpus) {
+    const char *b = line.data(), *e = b + line.size();
+    vector<tuple<int, int, int>> dfa_tokens, std_tokens;
+    set.MatchAll(b, e, [&](int mb, int me, int id){ dfa_tokens.emplace_back(mb, me, id); });
+    for (std::cregex_iterator m(b, e, set_std), end; m != end; ++m) {
+      int id = 0;
+      while (!(*m)[id + 1].matched) id++;
+      std_tokens.emplace_back(m->position(0), m->position(0) + m->length(0), id);
+    }
+    EXPECT(dfa_tokens == std_tokens, name, " set on ", line);
+  }
+}
+
+static void TestDFARegex() {
+  for (auto &p : vector<pair<string, string>>{ { "a|ab", "ab" }, { "(?:a|ab)(?:c|bcd)", "abcd" }, { "(?:aa|a)a", "aaa" } }) {
+    DFARegex dfa({ p.first });
+    std::regex std_rule(p.first);
+    std::smatch m;
+    const char *b = p.second.data(), *mb, *me;
+    int id;
+    EXPECT(dfa.Find(b, b + p.second.size(), b, &mb, &me, &id) && std::regex_search(p.second, m, std_rule) &&
+           me - mb == m.length(0), p.first);
+  }
+  TestDFARegexRules("cpp", cpp_rules, RegexCorpus("abc if int for 0.12 #/*\"'\\_:->=", {
+    "  for (int i = 0; i < n; ++i) total += values[i] * scale;", "#include <vector>", "  // trailing comment",
+    "  string label = StrCat(\"item \\\"\", index, \": \", name);", "  char c = '\\'';", "  /* block */ x->y::z" }));
+  TestDFARegexRules("cmake", cmake_rules, RegexCorpus("abcAB_ if endif ${}$<>\"# ()", {
+    "if(LFL_LIBCLANG)", "  set(TU_LIB app_clang_tu) # comment", "lfl_add_target(${NAME} $<TARGET_FILE:foo>)",
+    "  message(\"quoted \\\" ${VAR}\")", "endif()" }));
+}
+
+static void TestIgnoreRules() {
+  for (auto &g : vector<tuple<string, string, bool>>{
+    { "*.o", "a.o", 1 }, { "*.o", "a/b.o", 0 }, { "foo", "foobar", 0 }, { "a?c", "abc", 1 }, { "a?c", "a/c", 0 },
+    { "**/x", "x", 1 }, { "**/x", "a/b/x", 1 }, { "a/**/b", "a/b", 1 }, { "a/**/b", "a/x/y/b", 1 }, { "a/**", "a/b/c", 1 },
+    { "a/*", "a/b/c", 0 }, { "[a-c]x", "bx", 1 }, { "[!a-c]x", "bx", 0 }, { "[!a-c]x", "dx", 1 }, { "[ab", "a", 0 } })
+    EXPECT(IgnoreRules::Glob(get<0>(g).c_str(), get<1>(g).c_str()) == get<2>(g), get<0>(g), " on ", get<1>(g));
+
+  auto rules = IgnoreRules::Parse("# comment\n\n!keep.o\n/build/\n\\#lit\nsrc/gen\n*.o  \n/\n");
+  vector<IgnoreRules::Rule> expect(5);
+  expect[0].pattern = "keep.o";  expect[0].negate = true;
+  expect[1].pattern = "build";   expect[1].dir_only = expect[1].anchored = true;
+  expect[2].pattern = "#lit";
+  expect[3].pattern = "src/gen"; expect[3].anchored = true;
+  expect[4].pattern = "*.o";
+  EXPECT(rules == expect, rules.size());
+
+  IgnoreRules ignore;
+  ignore.rules["/r"] = IgnoreRules::Parse("*.o\n!keep.o\nbuild/\n/top\n");
+  ignore.rules["/r/sub"] = IgnoreRules::Parse("!x.o\n");
+  ignore.AddPrefix("/r/out/");
+  for (auto &i : vector<tuple<string, bool, bool>>{
+    { "/r/a.o", 0, 1 }, { "/r/keep.o", 0, 0 }, { "/r/sub/x.o", 0, 0 }, { "/r/sub/y.o", 0, 1 }, { "/r/build", 1, 1 },
+    { "/r/build", 0, 0 }, { "/r/sub/build", 1, 1 }, { "/r/top", 0, 1 }, { "/r/sub/top", 0, 0 }, { "/r/out", 1, 1 },
+    { "/r/out/x.cpp", 0, 1 }, { "/r/output", 1, 0 }, { "/r/.git", 1, 1 }, { "/r/a.cpp", 0, 0 } })
+    EXPECT(ignore.Ignored(get<0>(i), get<1>(i)) == get<2>(i), get<0>(i));
+}
+
+static String16 U16(const string &x) { return String::ToUTF16(x); }
+static string Text(const PieceTable &t) { return t.GetSnapshot()->File()->buf; }
+
+// Offsets of the starts of each line of text, for turning a model offset into the (y, x)
+// the piece table is addressed by.
+static pair<int, int> LinePosition(const string &text, size_t offset) {
+  int y = count(text.begin(), text.begin() + offset, '\n');
+  size_t nl = text.rfind('\n', offset ? offset - 1 : 0);
+  return make_pair(y, int(offset - (y && nl != string::npos ? nl + 1 : 0)));
+}
+
+static void TestPieceTable() {
+  PieceTable t;
+  t.Load(U16("ab\ncd\nef"));
+  auto before = t.GetSnapshot();
+  t.Insert(1, 1, U16("X\nY"));
+  EXPECT(Text(t) == "ab\ncX\nYd\nef" && t.lines == 4 && t.size == 11, Text(t));
+  t.Erase(0, 1, 3);
+  EXPECT(Text(t) == "aX\nYd\nef" && t.lines == 3, "erase across a newline ", Text(t));
+  t.Erase(2, 0, 100);
+  EXPECT(Text(t) == "aX\nYd\n" && t.lines == 3 && t.size == 6, "erase past the end ", Text(t));
+  EXPECT(before->File()->buf == "ab\ncd\nef" && before->lines == 3 && String::ToUTF8(before->Line(1)) == "cd" &&
+         before->version < t.version, "snapshot");
+  EXPECT(String::ToUTF8(t.GetSnapshot()->Line(1)) == "Yd" && t.GetSnapshot()->Line(2).empty(), "line");
+
+  // Fill the add chunk so the next insert starts another, then edit across the seam.
+  int fill = PieceTable::chunk_size - 1;
+  t.Load(U16("0\n1\n"));
+  t.Insert(1, 1, U16(string(fill, 'a')));
+  t.Insert(1, 1 + fill, U16("b\nc"));
+  EXPECT(t.lines == 4 && t.GetSnapshot()->Line(1).size() == size_t(fill + 2), "chunk boundary insert");
+  t.Erase(1, fill - 1, 4);
+  EXPECT(Text(t) == StrCat("0\n1", string(fill - 2, 'a'), "c\n") && t.lines == 3, "chunk boundary erase");
+
+  string model = "first\nsecond\n";
+  mt19937 rng(11);
+  t.Load(U16(model));
+  for (int i = 0; i < 3000; i++) {
+    size_t offset = rng() % (model.size() + 1);
+    auto p = LinePosition(model, offset);
+    if (rng() % 3) {
+      string text(rng() % 50 ? rng() % 8 : PieceTable::chunk_size / 8, 'a' + i % 26);
+      for (auto &c : text) if (!(rng() % 6)) c = '\n';
+      model.insert(offset, text);
+      t.Insert(p.first, p.second, U16(text));
+    } else {
+      size_t len = min(model.size() - offset, size_t(rng() % 12));
+      model.erase(offset, len);
+      t.Erase(p.first, p.second, len);
+    }
+    if (i % 100) continue;
+    EXPECT(Text(t) == model && t.size == int(model.size()) && t.lines == 1 + count(model.begin(), model.end(), '\n'), "random ", i);
+    vector<size_t> line_begin{ 0 };
+    for (size_t nl = 0; (nl = model.find('\n', nl)) != string::npos; nl++) line_begin.push_back(nl + 1);
+    auto snap = t.GetSnapshot();
+    for (int j = 0; j < 20; j++) {
+      int y = rng() % line_begin.size();
+      size_t b = line_begin[y], e = y + 1 < int(line_begin.size()) ? line_begin[y+1] - 1 : model.size();
+      EXPECT(String::ToUTF8(snap->Line(y)) == model.substr(b, e - b), "random ", i, " line ", y);
+    }
+  }
+}
+
+// Lines lexed by one catch-up pass, with a block comment's state as the anchor.
+static vector<int> LexPass(HighlightCheckpoints *h, const vector<string> &lines, int last) {
+  vector<int> lexed;
+  h->Start();
+  for (; h->scan_line < int(lines.size()); h->scan_line++) {
+    if (!h->Continue(last)) return lexed;
+    lexed.push_back(h->scan_line);
+    const string &l = lines[h->scan_line];
+    size_t open = l.rfind("/*"), close = l.rfind("*/");
+    if      (open  != string::npos && (close == string::npos || close < open)) h->scan_anchor = 1;
+    else if (close != string::npos) h->scan_anchor = 0;
+  }
+  h->Done();
+  return lexed;
+}
+
+static void TestHighlightCheckpoints() {
+  vector<string> lines(1000, "int x;");
+  lines[400] = "*/";
+  HighlightCheckpoints h(16);
+  auto Valid = [&](){
+    HighlightCheckpoints every(1);
+    LexPass(&every, lines, lines.size());
+    for (size_t i = 0; i < h.checkpoint.size(); i++)
+      if (h.checkpoint[i].line >= int(lines.size()) || (i && h.checkpoint[i].line <= h.checkpoint[i-1].line) ||
+          h.checkpoint[i].anchor != every.checkpoint[h.checkpoint[i].line].anchor) return false;
+    return true;
+  };
+
+  EXPECT(LexPass(&h, lines, 50).size() == 51 && h.frontier == 51 && !h.Pending(50) && h.Pending(60), "frontier");
+  EXPECT(LexPass(&h, lines, 999).size() == 949 && h.frontier == -1 && !h.Pending(999), "to the end");
+
+  lines[100] = "int y;";
+  h.Modify(100, 0, 0);
+  auto lexed = LexPass(&h, lines, 999);
+  EXPECT(lexed.size() == 16 && lexed[0] == 96 && Valid(), "converged ", lexed.size());
+
+  lines[200] = "/*";
+  h.Modify(200, 0, 0);
+  lexed = LexPass(&h, lines, 999);
+  EXPECT(lexed.size() == 224 && lexed[0] == 192 && Valid(), "state change ", lexed.size());
+
+  lines.insert(lines.begin() + 301, 5, "int z;");
+  h.Modify(300, 5, 0);
+  lexed = LexPass(&h, lines, 999);
+  EXPECT(lexed.size() < 40 && Valid(), "insert lines ", lexed.size());
+
+  lines.erase(lines.begin() + 501, lines.begin() + 541);
+  h.Modify(500, 0, 40);
+  lexed = LexPass(&h, lines, 999);
+  EXPECT(lexed.size() < 40 && Valid(), "erase lines ", lexed.size());
+
+  lines.erase(lines.begin() + 395, lines.begin() + 406);
+  h.Modify(394, 0, 11);
+  LexPass(&h, lines, 999);
+  EXPECT(Valid(), "erase the comment's end");
+}
+
+static void TestAnnotationStore() {
+  typedef DrawableAnnotation A;
+  AnnotationStore s;
+  A a{ { 0, 1 }, { 4, 2 }, { 9, 3 } }, b{ { 0, 5 } }, out;
+  s.Set(0, a);
+  s.Set(2, b);
+  s.Get(0, &out);
+  EXPECT(s.Slots() == 3 && out == a, "set");
+  s.Get(1, &out);
+  EXPECT(out.empty(), "empty slot");
+  int begin = s.slot_begin[0];
+  s.Set(0, b);
+  s.Get(0, &out);
+  EXPECT(out == b && s.slot_begin[0] == begin && s.garbage == 2, "rewrite in place");
+  s.Set(0, a);
+  s.Get(0, &out);
+  EXPECT(out == a && s.slot_begin[0] != begin && s.garbage == 3 && s.Equal(0, s, 0) && !s.Equal(0, s, 2), "rewrite appended");
+  s.Compact();
+  s.Get(0, &out);
+  EXPECT(out == a && !s.garbage && s.span_offset.size() == 4, "compact");
+  s.ClearRuns();
+  s.Get(0, &out);
+  EXPECT(s.Slots() == 3 && out.empty() && s.span_offset.empty(), "clear runs");
+
+  A packed{ { 0, 1 }, { 2, 1 }, { 5, 2 }, { 7, 2 }, { 8, 1 } };
+  AnnotationStore::Pack(&packed);
+  EXPECT((packed == A{ { 0, 1 }, { 5, 2 }, { 8, 1 } }), "pack");
+
+  A big;
+  for (int i = 0; i < 100; i++) big.emplace_back(i, i);
+  for (int i = 0; i < 1000; i++) { big[0].second = i; s.Set(i % 50, (i / 50) % 2 ? big : b); }
+  s.Get(49, &out);
+  EXPECT(out == big && out[0].second == 999 && s.span_offset.size() < 20000, "garbage compacted ", s.span_offset.size());
+
+  LineDeltas d;
+  d.Add(10, 2, 0);
+  d.Add(20, 0, 3);
+  EXPECT(d.ToCurrent(5, 0) == 5 && d.ToCurrent(10, 0) == 10 && d.ToCurrent(11, 0) == 13, "insert to current");
+  EXPECT(d.ToCurrent(19, 0) == -1 && d.ToCurrent(22, 0) == 21 && d.ToCurrent(30, 0) == 29, "erase to current");
+  bool edited;
+  EXPECT(d.ToPast(12, 0) == -1 && d.ToPast(13, 0) == 11 && d.ToPast(10, 0, &edited) == 10 && edited, "to past");
+  EXPECT(d.ToPast(21, 0) == 22 && d.ToPast(21, 1) == 24 && d.ToPast(21, 2) == 21, "to past since");
+  int position = d.Position();
+  d.Add(0, 1, 0);
+  d.Trim(position);
+  EXPECT(d.edit.size() == 1 && d.Position() == 3 && d.ToCurrent(5, position) == 6 && d.ToPast(6, position) == 5, "trim");
+  for (int line = 0; line < 40; line++) {
+    int current = d.ToCurrent(line, position);
+    EXPECT(current < 0 || d.ToPast(current, position) == line, "round trip ", line);
+  }
+}
+
+// Edits between two line lists, minimal and consistent with the lines they leave alone.
+static void TestLineDiff() {
+  typedef LineDiff D;
+  auto H = [](const string &t) { return D::HashLines(t.data(), t.data() + t.size()); };
+  EXPECT(H("a\nb\n").size() == 2 && H("a\nb").size() == 2 && H("").empty() && H("\n").size() == 1, "hash lines");
+  auto hunks = D::Diff(H("a\nb\nc\nd\ne\n"), H("a\nX\nc\nd\ne\nf\n"));
+  EXPECT(hunks.size() == 2 && hunks[0].a == 1 && hunks[0].a_len == 1 && hunks[0].b == 1 && hunks[0].b_len == 1 &&
+         hunks[1].a == 5 && !hunks[1].a_len && hunks[1].b == 5 && hunks[1].b_len == 1, "hunks");
+  EXPECT((D::Marks(hunks, 6) == vector<char>{ D::Unchanged, D::Modified, D::Unchanged, D::Unchanged, D::Unchanged, D::Added }), "marks");
+  hunks = D::Diff(H("a\nb\nc\n"), H("a\nc\n"));
+  EXPECT(hunks.size() == 1 && hunks[0].a == 1 && hunks[0].a_len == 1 && !hunks[0].b_len && D::Marks(hunks, 2)[1] == D::Deleted, "deletion");
+  hunks = D::Diff(H("a\nb\nc\nd\n"), H("x\nb\nc\ny\n"), 1);
+  EXPECT(hunks.size() == 1 && hunks[0].a == 0 && hunks[0].a_len == 4 && hunks[0].b_len == 4, "past max_d");
+  EXPECT(D::Unified("a\nb\nc\n", "a\nx\nc\n", "a", "b") == "--- a\n+++ b\n@@ -1,3 +1,3 @@\n a\n-b\n+x\n c\n", "unified");
+
+  mt19937 rng(5);
+  for (int i = 0; i < 300; i++) {
+    vector<D::Hash> a(rng() % 30), b(rng() % 30);
+    for (auto &x : a) x = rng() % 4;
+    for (auto &x : b) x = rng() % 4;
+    vector<vector<int>> lcs(a.size() + 1, vector<int>(b.size() + 1, 0));
+    for (int x = a.size() - 1; x >= 0; x--)
+      for (int y = b.size() - 1; y >= 0; y--)
+        lcs[x][y] = a[x] == b[y] ? lcs[x+1][y+1] + 1 : max(lcs[x+1][y], lcs[x][y+1]);
+    int edits = 0, x = 0, y = 0;
+    bool same = true;
+    for (auto &h : D::Diff(a, b)) {
+      for (; x < h.a; x++, y++) same &= y < h.b && a[x] == b[y];
+      same &= y == h.b;
+      x += h.a_len;
+      y += h.b_len;
+      edits += h.a_len + h.b_len;
+    }
+    for (; x < int(a.size()); x++, y++) same &= y < int(b.size()) && a[x] == b[y];
+    EXPECT(same && y == int(b.size()) && edits == int(a.size() + b.size()) - 2 * lcs[0][0], "random ", i);
+  }
+
+  PieceTable t;
+  string text = "one\ntwo\nthree\n";
+  t.Load(U16(text));
+  LineHashes lh;
+  lh.Reset(H(text), t.lines);
+  for (int i = 0; i < 500; i++) {
+    text = Text(t);
+    auto p = LinePosition(text, rng() % (text.size() + 1));
+    if (rng() % 2) {
+      string ins = rng() % 3 ? "x" : "y\nz\n";
+      t.Insert(p.first, p.second, U16(ins));
+      lh.Modify(p.first, count(ins.begin(), ins.end(), '\n'), 0);
+    } else {
+      size_t offset = t.Offset(p.first, p.second), len = min(text.size() - offset, size_t(rng() % 6));
+      t.Erase(p.first, p.second, len);
+      lh.Modify(p.first, 0, count(text.begin() + offset, text.begin() + offset + len, '\n'));
+    }
+    auto snap = t.GetSnapshot();
+    lh.Rehash([&](int y){ return String::ToUTF8(snap->Line(y)); });
+    EXPECT(lh.valid && lh.Hashes() == H(snap->File()->buf), "line hashes ", i);
+  }
+}
+
+static void TestUndoLog() {
+  typedef UndoLog::Change C;
+  auto Same = [](const vector<C> &c, int y, int x, bool erase, const string &text) {
+    return c.size() == 1 && c[0].y == y && c[0].x == x && c[0].erase == erase && c[0].text == U16(text);
+  };
+  Time t = Time(0);
+  vector<C> c;
+  UndoLog u(1 << 20, Seconds(1));
+  u.Add(0, 0, false, U16("a"), t);
+  u.Add(0, 1, false, U16("b"), t);
+  u.Add(0, 2, false, U16("c"), t);
+  EXPECT(u.Entries() == 1 && u.merged == 2 && u.Undo(&c) && Same(c, 0, 0, true, "abc"), "typing merges");
+  c.clear();
+  EXPECT(u.Redo(&c) && Same(c, 0, 0, false, "abc") && !u.Redo(&c), "redo");
+  u.Add(0, 2, true, U16("c"), t);
+  u.Add(0, 1, true, U16("b"), t);
+  c.clear();
+  EXPECT(u.Entries() == 2 && u.Undo(&c) && Same(c, 0, 1, false, "bc"), "backspace merges reversed");
+  u.Add(0, 1, false, U16("\n"), t);
+  u.Add(1, 0, false, U16("d"), t);
+  u.Add(1, 1, false, U16("e"), t + Seconds(5));
+  EXPECT(u.Entries() == 4, "newlines and pauses don't merge, undone entries are truncated ", u.Entries());
+
+  UndoLog g(1 << 20, Seconds(1));
+  g.Add(0, 0, false, U16("old"), t);
+  g.Add(0, 0, true, U16("old"), t + Seconds(2), 7);
+  g.Add(0, 0, false, U16("new"), t + Seconds(2), 7);
+  c.clear();
+  EXPECT(g.Undo(&c) && c.size() == 2 && c[0].erase && c[0].text == U16("new") && !c[1].erase, "group undo");
+  c.clear();
+  EXPECT(g.Redo(&c) && c.size() == 2 && c[0].erase && c[1].text == U16("new"), "group redo");
+  c.clear();
+  EXPECT(g.Undo(&c) && g.Undo(&c) && c.size() == 3 && !g.Undo(&c), "group undo then the rest");
+
+  // Past the cap the oldest text goes to disk, and past that it's forgotten.
+  UndoLog s(0, Time(0));
+  auto Entry = [](int i) { return string(1000, 'a' + i % 26) + to_string(i); };
+  for (int i = 0; i < 300; i++) s.Add(i, 0, false, U16(Entry(i)), t + Seconds(i));
+  EXPECT(s.spilled && s.dropped && s.Bytes() <= s.cap && s.Entries() + s.dropped == 300, s.StatsString());
+  int kept = s.Entries(), undone = 0;
+  for (c.clear(); s.Undo(&c); c.clear(), undone++)
+    EXPECT(Same(c, 299 - undone, 0, true, Entry(299 - undone)), "spilled undo ", undone);
+  EXPECT(undone == kept, undone, " of ", kept);
+  for (int i = 0; i < kept / 2; i++) s.Redo(&c);
+  EXPECT(s.spilled > kept / 2, "truncating inside the spilled entries ", s.StatsString());
+  s.Add(0, 0, false, U16("after"), t + Seconds(1000));
+  c.clear();
+  EXPECT(s.Entries() == kept / 2 + 1 && s.Undo(&c) && Same(c, 0, 0, true, "after"), "truncate into the spill");
+  c.clear();
+  EXPECT(s.Undo(&c) && Same(c, 300 - kept + kept / 2 - 1, 0, true, Entry(300 - kept + kept / 2 - 1)), "spilled after truncate");
+}
+
+static void TestTranslationUnitScheduler() {
+  vector<string> started;
+  TranslationUnitScheduler s(2);
+  s.start_cb = [&](const string &fn){ started.push_back(fn); };
+  s.Request("a");
+  s.Request("b");
+  s.Request("c");
+  s.Request("a");
+  s.Request("a");
+  EXPECT((started == vector<string>{ "a", "b" }) && s.QueueDepth() == 2 && s.stats.coalesced == 1 && s.Busy("c"), "coalesce");
+  s.Done("a");
+  EXPECT((started == vector<string>{ "a", "b", "c" }) && s.QueueDepth() == 1, "one parse per file");
+  s.Request("d");
+  s.Cancel("d");
+  s.front = "e";
+  s.Request("f");
+  s.Request("e");
+  s.Done("b");
+  EXPECT(started.back() == "e" && s.stats.cancelled == 1 && !s.Busy("d"), "front first");
+  s.Done("c");
+  s.Done("e");
+  s.Done("a");
+  s.Done("f");
+  EXPECT((started == vector<string>{ "a", "b", "c", "e", "a", "f" }) && !s.QueueDepth() && s.running.empty() &&
+         s.stats.completed == 6 && s.Done("x") == Time(0), "drained");
+}
+
+static void TestJobScheduler() {
+  typedef JobScheduler::Job Job;
+  vector<int> started, cancelled;
+  JobScheduler s(3);
+  s.start_cb = [&](const shared_ptr<Job> &j){ started.push_back(j->id); return j->name != "fails"; };
+  s.cancel_cb = [&](Job *j){ cancelled.push_back(j->id); };
+  Job *a = s.Add("a", "", {}, 64), *b = s.Add("b", "", {}, 64), *c = s.Add("c", "", {}, 64);
+  Job *build = s.Add("build", "", {}, 64, 100), *d = s.Add("d", "", {}, 64);
+  EXPECT(started.size() == 3 && build->slots == 3 && build->state == JobScheduler::Queued && d->state == JobScheduler::Queued,
+         "a full job waits behind single-slot ones, and holds back the rest");
+  s.Done(a, 0);
+  s.Done(b, 0);
+  EXPECT(started.size() == 3 && s.RunningSlots() == 1, "still waiting for every slot");
+  s.Done(c, 1);
+  EXPECT(started.size() == 4 && started.back() == build->id && s.RunningSlots() == 3 && d->state == JobScheduler::Queued, "runs alone");
+  s.Done(build, 0);
+  EXPECT(started.back() == d->id && s.stats.failed == 1, "then the rest");
+
+  Job *e = s.Add("e", "", {}, 64), *f = s.Add("f", "", {}, 64, 3);
+  s.Cancel(f);
+  EXPECT(f->state == JobScheduler::Finished && f->cancelled && f->status == -1 && started.back() == e->id, "cancel queued");
+  s.Cancel(e);
+  EXPECT(cancelled == vector<int>{ e->id } && e->state == JobScheduler::Running, "cancel running signals");
+  s.Done(e, -1);
+  s.Done(d, 0);
+  Job *g = s.Add("fails", "", {}, 64);
+  EXPECT(g->state == JobScheduler::Finished && g->status == -1 && s.Idle(), "start failed");
+
+  s.StartBatch();
+  EXPECT(s.job.empty(), "new batch");
+  Job *h = s.Add("h", "", {}, 64, 3);
+  s.Add("i", "", {}, 64);
+  s.Add("j", "", {}, 64);
+  size_t n = started.size();
+  s.CancelAll();
+  EXPECT(started.size() == n && cancelled.back() == h->id && s.Count(JobScheduler::Queued) == 0 &&
+         s.stats.cancelled == 4, "cancel all starts nothing ", s.StatsString());
+}
+
+static void WriteTestFile(const string &fn, const string &text) { ofstream out(fn, ios::binary); out << text; }
+
+// Journals written record by record against a file on disk, replayed as after a crash.
+static void TestEditJournal() {
+  typedef EditJournal J;
+  string fn = "tepidfusion_test.txt", jfn = "tepidfusion_test.journal", v1 = "hello\nworld\n", v2 = "hello!\nworld\n";
+  auto Recover = [&](const string &journal) { WriteTestFile(jfn, journal); return J::Recover(jfn); };
+  auto Recovers = [&](const vector<J::Recovery> &r, const string &text) { return r.size() == 1 && r[0].filename == fn && r[0].text == text; };
+
+  WriteTestFile(fn, v1);
+  string base = J::Record(J::Base, fn, 1, J::HashText(v1)), edit = J::Record(J::Edit, fn, 2, 0, 5, 0, "!");
+  string edit2 = J::Record(J::Edit, fn, 3, 1, 0, 1, "w");
+  EXPECT(Recovers(Recover(base + edit), v2), "replay");
+  EXPECT(Recovers(Recover(base + edit + edit2), "hello!\norld\n"), "replay erase");
+  EXPECT(Recover(base).empty(), "no edits");
+  EXPECT(Recover(base + edit + J::Record(J::Closed, fn, 0, 0)).empty(), "closed");
+  EXPECT(Recovers(Recover(base + edit + J::Record(J::Closed, fn, 0, 0) + base + edit), v2), "reopened");
+  for (size_t torn = 1; torn < edit2.size(); torn++)
+    EXPECT(Recovers(Recover(base + edit + edit2.substr(0, torn)), v2), "torn at ", torn);
+
+  WriteTestFile(fn, v2);
+  string saved = J::Record(J::Saved, fn, 2, J::HashText(v2));
+  EXPECT(Recovers(Recover(base + edit + edit2 + saved), "hello!\norld\n"), "saved");
+  EXPECT(Recover(base + edit + saved).empty(), "saved all");
+  EXPECT(Recover(base + edit).empty(), "changed on disk");
+  string recovered = J::Record(J::Recovered, fn, 1, J::HashText(v2), 0, 0, "hi!\nworld\n");
+  EXPECT(Recovers(Recover(recovered + edit2), "hi!\norld\n"), "recovered");
+
+  {
+    EditJournal journal(jfn, 0);
+    journal.AddBase(fn, 1, J::HashText(v2));
+    journal.AddEdit(fn, 2, 1, 5, 0, "s");
+  }
+  EXPECT(Recovers(J::Recover(jfn), "hello!\nworlds\n"), "append");
+  {
+    EditJournal journal(jfn, 0);
+    journal.AddEdit(fn, 3, 0, 0, 0, "dropped");
+    journal.Compact(J::Record(J::Recovered, fn, 3, J::HashText(v2), 0, 0, "compacted\n"));
+    journal.AddEdit(fn, 4, 0, 0, 0, ">");
+  }
+  EXPECT(Recovers(J::Recover(jfn), ">compacted\n") && LocalFile::FileContents(jfn).find("dropped") == string::npos, "compact");
+  EXPECT(AtomicFile::Write(jfn, "replaced") && LocalFile::FileContents(jfn) == "replaced", "atomic write");
+  unlink(fn.c_str());
+  unlink(jfn.c_str());
+}
+
+}; // namespace LFL
+using namespace LFL;
+
+extern "C" LFApp *MyAppCreate(int argc, const char* const* argv) {
+  FLAGS_enable_video = FLAGS_enable_input = false;
+  app = make_unique<Application>(argc, argv).release();
+  app->name = "TepidFusionTests";
+  return app;
+}
+
+extern "C" int MyAppMain(LFApp *application) {
+  if (app->Create(__FILE__)) return -1;
+  if (app->Init()) return -1;
+  TestDFARegex();
+  TestIgnoreRules();
+  TestPieceTable();
+  TestHighlightCheckpoints();
+  TestAnnotationStore();
+  TestLineDiff();
+  TestUndoLog();
+  TestTranslationUnitScheduler();
+  TestJobScheduler();
+  TestEditJournal();
+  INFO("tests: ", failures, " failures");
+  return failures ? 1 : 0;
+}
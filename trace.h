@@ -0,0 +1,106 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_TRACE_H__
+#define LFL_EDITOR_TRACE_H__
+namespace LFL {
+
+// Scoped spans recorded into a ring per thread.  Only the owning thread writes a ring,
+// so recording is a relaxed load when disabled and two clock reads and a store when
+// enabled.  Threads register their ring once, under a lock.
+struct Trace {
+  struct Event { const char *name; long long begin, dur; };
+  struct Buffer {
+    int tid;
+    vector<Event> event;
+    atomic<size_t> count{0};
+    Buffer(int T, size_t size) : tid(T), event(size) {}
+  };
+  static const size_t buffer_size = 1 << 16;
+
+  static atomic<bool> &Enabled() { static atomic<bool> enabled(false); return enabled; }
+  static mutex &Lock() { static mutex lock; return lock; }
+  static vector<shared_ptr<Buffer>> &Buffers() { static vector<shared_ptr<Buffer>> buffers; return buffers; }
+
+  static long long Microseconds() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static Buffer *ThreadBuffer() {
+    static thread_local Buffer *buffer = nullptr;
+    if (!buffer) {
+      ScopedMutex l(Lock());
+      auto &buffers = Buffers();
+      buffers.push_back(make_shared<Buffer>(buffers.size() + 1, buffer_size));
+      buffer = buffers.back().get();
+    }
+    return buffer;
+  }
+
+  static void Add(const char *name, long long begin, long long dur) {
+    Buffer *b = ThreadBuffer();
+    size_t n = b->count.load(memory_order_relaxed);
+    b->event[n % b->event.size()] = Event{ name, begin, dur };
+    b->count.store(n + 1, memory_order_release);
+  }
+
+  static void Clear() {
+    ScopedMutex l(Lock());
+    for (auto &b : Buffers()) b->count.store(0, memory_order_release);
+  }
+
+  // Chrome trace format, for chrome://tracing or Perfetto.  Spans recorded while the
+  // export runs may be torn, so disable tracing first for a clean capture.
+  static string ChromeJSON() {
+    string ret = "{\"traceEvents\":[";
+    bool first = true;
+    ScopedMutex l(Lock());
+    for (auto &b : Buffers()) {
+      size_t n = b->count.load(memory_order_acquire), size = b->event.size();
+      for (size_t i = n > size ? n - size : 0; i < n; i++, first = false) {
+        const Event &e = b->event[i % size];
+        StrAppend(&ret, first ? "" : ",", "\n{\"name\":\"", e.name, "\",\"ph\":\"X\",\"pid\":1,\"tid\":", b->tid,
+                  ",\"ts\":", e.begin, ",\"dur\":", e.dur, "}");
+      }
+    }
+    return ret + "\n]}\n";
+  }
+
+  static int Events() {
+    ScopedMutex l(Lock());
+    size_t ret = 0;
+    for (auto &b : Buffers()) ret += min(b->count.load(), b->event.size());
+    return ret;
+  }
+};
+
+struct TraceSpan {
+  const char *name;
+  long long begin=0;
+  TraceSpan(const char *N) : name(Trace::Enabled().load(memory_order_relaxed) ? N : nullptr) {
+    if (name) begin = Trace::Microseconds();
+  }
+  ~TraceSpan() { if (name) Trace::Add(name, begin, Trace::Microseconds() - begin); }
+};
+
+#define TRACE_SPAN_NAME2(n) trace_span_ ## n
+#define TRACE_SPAN_NAME(n) TRACE_SPAN_NAME2(n)
+#define TRACE_SPAN(name) LFL::TraceSpan TRACE_SPAN_NAME(__COUNTER__)(name)
+
+}; // namespace LFL
+#endif // LFL_EDITOR_TRACE_H__
@@ -0,0 +1,104 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_TU_SCHEDULER_H__
+#define LFL_EDITOR_TU_SCHEDULER_H__
+namespace LFL {
+
+// Main-thread bookkeeping for translation unit parses.  At most one parse per file is
+// in flight; further requests for that file collapse into a single pending entry that's
+// started, with whatever text is current then, once the running parse lands.
+struct TranslationUnitScheduler {
+  struct Pending { string filename; Time queued; };
+  struct Stats {
+    long long requested=0, coalesced=0, cancelled=0, completed=0;
+    Time wait_total=Time(0), latency_total=Time(0), latency_max=Time(0), latency_last=Time(0);
+  };
+
+  int workers;
+  string front;
+  vector<Pending> pending;
+  unordered_map<string, Time> running;
+  function<void(const string&)> start_cb;
+  Stats stats;
+  TranslationUnitScheduler(int W=1) : workers(max(1, W)) {}
+
+  int QueueDepth() const { return pending.size(); }
+  bool Busy(const string &fn) const { return running.count(fn) || FindPending(fn) != pending.end(); }
+
+  vector<Pending>::const_iterator FindPending(const string &fn) const {
+    return find_if(pending.begin(), pending.end(), [&](const Pending &p){ return p.filename == fn; });
+  }
+
+  void Request(const string &fn) {
+    stats.requested++;
+    if (FindPending(fn) != pending.end()) stats.coalesced++;
+    else pending.push_back(Pending{ fn, Now() });
+    Dispatch();
+  }
+
+  void Cancel(const string &fn) {
+    auto i = FindPending(fn);
+    if (i == pending.end()) return;
+    pending.erase(i);
+    stats.cancelled++;
+  }
+
+  void Dispatch() {
+    while (running.size() < size_t(workers)) {
+      auto next = pending.end();
+      for (auto i = pending.begin(); i != pending.end(); ++i) {
+        if (running.count(i->filename)) continue;
+        if (i->filename == front) { next = i; break; }
+        if (next == pending.end()) next = i;
+      }
+      if (next == pending.end()) break;
+      Pending p = move(*next);
+      pending.erase(next);
+      Time now = Now();
+      stats.wait_total += now - p.queued;
+      running[p.filename] = now;
+      start_cb(p.filename);
+    }
+  }
+
+  Time Done(const string &fn) {
+    auto i = running.find(fn);
+    if (i == running.end()) return Time(0);
+    Time latency = Now() - i->second;
+    running.erase(i);
+    stats.completed++;
+    stats.latency_total += latency;
+    stats.latency_last = latency;
+    stats.latency_max = max(stats.latency_max, latency);
+    Dispatch();
+    return latency;
+  }
+
+  string StatsString() const {
+    auto ms = [](Time t){ return chrono::duration_cast<chrono::milliseconds>(t).count(); };
+    return StrCat("workers=", workers, " running=", running.size(), " queued=", pending.size(),
+                  " requested=", stats.requested, " coalesced=", stats.coalesced, " cancelled=", stats.cancelled,
+                  " completed=", stats.completed, " last_ms=", ms(stats.latency_last), " max_ms=", ms(stats.latency_max),
+                  " avg_ms=", stats.completed ? ms(stats.latency_total) / stats.completed : 0,
+                  " avg_wait_ms=", stats.completed ? ms(stats.wait_total) / stats.completed : 0);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_TU_SCHEDULER_H__
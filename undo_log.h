@@ -0,0 +1,214 @@
+/*
+ * $Id$
+ * Copyright (C) 2009 Lucid Fusion Labs
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LFL_EDITOR_UNDO_LOG_H__
+#define LFL_EDITOR_UNDO_LOG_H__
+namespace LFL {
+
+// One buffer's undo history, its text in an append-only arena of chunks.  An edit that
+// continues the last one, typing on or deleting either way on the same line soon after,
+// extends it in place, so a run of keystrokes undoes as one, and the entries of one
+// input event, ie the erase and insert replacing a selection, undo together.  Past the
+// memory cap the oldest entries' text is spilled to a temp file and their chunks freed,
+// and once even the entries, or the spilled text, don't fit the oldest are forgotten.
+struct UndoLog {
+  struct Change { int y, x; bool erase; String16 text; };
+  struct Entry {
+    int y, x, len, chunk, group;
+    long long offset;
+    bool erase, reversed, newline, on_disk;
+  };
+  struct Chunk {
+    unique_ptr<char16_t[]> data;
+    int size=0, capacity;
+    Chunk(int cap) : data(new char16_t[cap]), capacity(cap) {}
+  };
+  static const int chunk_size = 16*1024;
+
+  size_t cap;
+  Time merge_window, last_add=Time(0);
+  deque<Entry> entry;
+  deque<Chunk> chunk;
+  int pos=0, chunk_base=0, spilled=0;
+  FILE *spill=0;
+  long long spill_size=0, merged=0, dropped=0;
+  UndoLog(size_t C, Time W) : cap(max(size_t(chunk_size * 2 * sizeof(char16_t)), C)), merge_window(W) {}
+  virtual ~UndoLog() { if (spill) fclose(spill); }
+
+  int Entries() const { return entry.size(); }
+  size_t Bytes() const {
+    size_t ret = entry.size() * sizeof(Entry);
+    for (auto &c : chunk) ret += c.data ? c.capacity * sizeof(char16_t) : 0;
+    return ret;
+  }
+
+  // Entries with the same group, unless it's negative, undo and redo as one.
+  void Add(int y, int x, bool erase, const String16 &text, Time now, int group=-1) {
+    if (text.empty()) return;
+    Truncate(pos);
+    bool newline = find(text.begin(), text.end(), '\n') != text.end();
+    bool merge = pos && !newline && now - last_add < merge_window;
+    last_add = now;
+    if (merge && Extend(&entry.back(), y, x, erase, text)) { merged++; return; }
+    Entry e{ y, x, 0, 0, group, 0, erase, false, newline, false };
+    Append(&e, text.data(), text.size(), false);
+    entry.push_back(e);
+    pos++;
+    Bound();
+  }
+
+  // The inverse of the last entry and of the ones in its group, in the order to apply them.
+  bool Undo(vector<Change> *out) {
+    if (!pos) return false;
+    int group = entry[pos-1].group;
+    do {
+      const Entry &e = entry[--pos];
+      out->push_back(Change{ e.y, e.x, !e.erase, Text(e) });
+    } while (pos && group >= 0 && entry[pos-1].group == group);
+    return true;
+  }
+
+  bool Redo(vector<Change> *out) {
+    if (pos == int(entry.size())) return false;
+    int group = entry[pos].group;
+    do {
+      const Entry &e = entry[pos++];
+      out->push_back(Change{ e.y, e.x, e.erase, Text(e) });
+    } while (pos < int(entry.size()) && group >= 0 && entry[pos].group == group);
+    return true;
+  }
+
+  String16 Text(const Entry &e) const {
+    String16 ret(e.len, 0);
+    if (e.on_disk) {
+      if (fseek(spill, e.offset, SEEK_SET) || fread(&ret[0], sizeof(char16_t), e.len, spill) != size_t(e.len))
+        ERROR("undo spill read failed");
+    } else memcpy(&ret[0], &chunk[e.chunk - chunk_base].data[e.offset], e.len * sizeof(char16_t));
+    if (e.reversed) reverse(ret.begin(), ret.end());
+    return ret;
+  }
+
+  // Whether e's text ends the arena, so more can be appended to it in place.
+  bool AtTail(const Entry &e) const {
+    if (e.on_disk || e.chunk != chunk_base + int(chunk.size()) - 1) return false;
+    const Chunk &c = chunk.back();
+    return e.offset + e.len == c.size;
+  }
+
+  // Typing on from the end of an insert, deleting forward from the start of an erase, or
+  // backspacing into one, which is stored reversed.
+  bool Extend(Entry *e, int y, int x, bool erase, const String16 &text) {
+    if (e->newline || e->erase != erase || e->y != y || !AtTail(*e) ||
+        chunk.back().capacity - chunk.back().size < int(text.size())) return false;
+    if (!erase) {
+      if (x != e->x + e->len) return false;
+      Append(e, text.data(), text.size(), true);
+    } else if (x == e->x && !e->reversed) {
+      Append(e, text.data(), text.size(), true);
+    } else if (x + int(text.size()) == e->x && (e->reversed || e->len == 1)) {
+      String16 reversed(text.rbegin(), text.rend());
+      Append(e, reversed.data(), reversed.size(), true);
+      e->reversed = true;
+      e->x = x;
+    } else return false;
+    return true;
+  }
+
+  // Extending, e ends the arena and the last chunk has room.
+  void Append(Entry *e, const char16_t *text, int len, bool extend) {
+    if (!extend) {
+      if (chunk.empty() || chunk.back().capacity - chunk.back().size < len) chunk.emplace_back(max(len, int(chunk_size)));
+      e->chunk = chunk_base + chunk.size() - 1;
+      e->offset = chunk.back().size;
+      e->len = 0;
+    }
+    Chunk &c = chunk.back();
+    memcpy(&c.data[c.size], text, len * sizeof(char16_t));
+    c.size += len;
+    e->len += len;
+  }
+
+  // Forgets the entries from n on, handing their arena and spill space back.
+  void Truncate(int n) {
+    if (n >= int(entry.size())) return;
+    entry.erase(entry.begin() + n, entry.end());
+    pos = min(pos, n);
+    spilled = min(spilled, n);
+    spill_size = spilled ? entry[spilled-1].offset + entry[spilled-1].len * sizeof(char16_t) : 0;
+    if (spilled == int(entry.size())) { chunk_base += chunk.size(); chunk.clear(); return; }
+    const Entry &last = entry.back();
+    while (chunk_base + int(chunk.size()) - 1 > last.chunk) chunk.pop_back();
+    chunk.back().size = last.offset + last.len;
+  }
+
+  // Spills the oldest entries until the arena is within half the cap, then frees the
+  // chunks no entry in memory uses.  Entries over half the cap are forgotten.
+  void Bound() {
+    if (Bytes() <= cap) return;
+    if (!spill) spill = tmpfile();
+    size_t arena = Bytes() - entry.size() * sizeof(Entry);
+    while (spill && arena > cap / 2 && spilled < int(entry.size()) - 1) {
+      Entry &e = entry[spilled];
+      size_t bytes = e.len * sizeof(char16_t);
+      if (fseek(spill, spill_size, SEEK_SET) || fwrite(&chunk[e.chunk - chunk_base].data[e.offset], 1, bytes, spill) != bytes) {
+        ERROR("undo spill write failed");
+        break;
+      }
+      e.offset = spill_size;
+      e.on_disk = true;
+      spill_size += bytes;
+      spilled++;
+      int first = entry[spilled].chunk;
+      while (chunk_base < first) { arena -= chunk.front().capacity * sizeof(char16_t); chunk.pop_front(); chunk_base++; }
+    }
+    while (entry.size() > 1 && (entry.size() * sizeof(Entry) > cap / 2 || (!spill && Bytes() > cap))) PopFront();
+    while (spilled > 1 && spill_size - entry.front().offset > (long long)cap) PopFront();
+    if (!spilled) spill_size = 0;
+    else if (entry.front().offset > spill_size - entry.front().offset) CompactSpill();
+  }
+
+  void PopFront() {
+    entry.pop_front();
+    pos = max(0, pos - 1);
+    if (spilled) spilled--;
+    else {
+      int first = entry.front().chunk;
+      while (chunk_base < first) { chunk.pop_front(); chunk_base++; }
+    }
+    dropped++;
+  }
+
+  // Moves the spilled text still in use to the start of the file, once it's the lesser part.
+  void CompactSpill() {
+    long long base = entry.front().offset;
+    string live(spill_size - base, 0);
+    if (fseek(spill, base, SEEK_SET) || fread(&live[0], 1, live.size(), spill) != live.size() ||
+        fseek(spill, 0, SEEK_SET) || fwrite(live.data(), 1, live.size(), spill) != live.size())
+      return ERROR("undo spill compact failed");
+    for (int i = 0; i < spilled; i++) entry[i].offset -= base;
+    spill_size -= base;
+  }
+
+  string StatsString() const {
+    return StrCat("entries=", entry.size(), " undo=", pos, " kb=", Bytes() >> 10, " spilled=", spilled,
+                  " spill_kb=", spill_size >> 10, " merged=", merged, " dropped=", dropped);
+  }
+};
+
+}; // namespace LFL
+#endif // LFL_EDITOR_UNDO_LOG_H__